@@ -0,0 +1,165 @@
+#include "Archive.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+const size_t BLOCK_SIZE = 512;
+
+// Header fields are NUL- or space-terminated octal; very large GNU sizes use base-256 instead
+size_t parseOctal(const char* field, size_t length) {
+    if (static_cast<unsigned char>(field[0]) & 0x80) {
+        size_t value = 0;
+        for (size_t i = 1; i < length; ++i) {
+            value = (value << 8) | static_cast<unsigned char>(field[i]);
+        }
+        return value;
+    }
+
+    size_t value = 0;
+    for (size_t i = 0; i < length && field[i] != '\0' && field[i] != ' '; ++i) {
+        if (field[i] < '0' || field[i] > '7') {
+            break;
+        }
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+std::string readField(const char* field, size_t length) {
+    return std::string(field, strnlen(field, length));
+}
+
+bool isZeroBlock(const char* block) {
+    return std::all_of(block, block + BLOCK_SIZE, [](char c) { return c == '\0'; });
+}
+
+bool checksumMatches(const char* block) {
+    size_t sum = 0;
+    for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+        // The checksum field itself counts as spaces
+        sum += (i >= 148 && i < 156) ? ' ' : static_cast<unsigned char>(block[i]);
+    }
+    return sum == parseOctal(block + 148, 8);
+}
+
+size_t paddedSize(size_t size) {
+    return (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+}
+
+// A pax extended header is a list of "<length> <key>=<value>\n" records; only the path matters here
+std::string paxPath(const std::vector<uchar>& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        size_t space = offset;
+        while (space < data.size() && data[space] != ' ') {
+            ++space;
+        }
+        size_t length = std::strtoul(std::string(data.begin() + offset, data.begin() + space).c_str(), nullptr, 10);
+        // The record must hold the space, at least one byte of key=value and the closing newline
+        if (length == 0 || offset + length > data.size() || space + 1 >= offset + length) {
+            break;
+        }
+
+        std::string record(data.begin() + space + 1, data.begin() + offset + length - 1);
+        if (record.compare(0, 5, "path=") == 0) {
+            return record.substr(5);
+        }
+        offset += length;
+    }
+    return "";
+}
+
+}
+
+TarReader::TarReader(const std::string& archivePath) : buffer_(1 << 20) {
+    // A large stream buffer keeps reads sequential and few, which is what network volumes like
+    file_.rdbuf()->pubsetbuf(buffer_.data(), buffer_.size());
+    file_.open(archivePath, std::ios::binary);
+    if (!file_.is_open()) {
+        std::cerr << "Failed to open archive: " << archivePath << std::endl;
+    }
+}
+
+bool TarReader::readBlock(char* block) {
+    return static_cast<bool>(file_.read(block, BLOCK_SIZE));
+}
+
+bool TarReader::readPayload(size_t size, std::vector<uchar>& data) {
+    data.resize(size);
+    if (size > 0 && !file_.read(reinterpret_cast<char*>(data.data()), size)) {
+        return false;
+    }
+    return skipPayload(paddedSize(size) - size);
+}
+
+bool TarReader::skipPayload(size_t size) {
+    // ignore() instead of seekg() so that pipes and other non-seekable inputs work too
+    return size == 0 || static_cast<bool>(file_.ignore(size));
+}
+
+bool TarReader::next(TarMember& member) {
+    std::string longName;
+    char block[BLOCK_SIZE];
+
+    while (readBlock(block)) {
+        if (isZeroBlock(block)) {
+            return false; // End-of-archive marker
+        }
+        if (!checksumMatches(block)) {
+            std::cerr << "Corrupt tar header, stopping" << std::endl;
+            return false;
+        }
+
+        size_t size = parseOctal(block + 124, 12);
+        char type = block[156];
+
+        if (type == 'L' || type == 'x') {
+            // GNU long name / pax extended header: applies to the member that follows
+            std::vector<uchar> data;
+            if (!readPayload(size, data)) {
+                std::cerr << "Truncated tar extended header, stopping" << std::endl;
+                return false;
+            }
+            std::string name = type == 'L' ? readField(reinterpret_cast<const char*>(data.data()), data.size()) : paxPath(data);
+            if (!name.empty()) {
+                longName = name;
+            }
+            continue;
+        }
+
+        if (type != '0' && type != '\0' && type != '7') {
+            // Directories, links and global headers carry no image data
+            longName.clear();
+            if (!skipPayload(paddedSize(size))) {
+                std::cerr << "Truncated tar entry: " << readField(block, 100) << std::endl;
+                return false;
+            }
+            continue;
+        }
+
+        if (!longName.empty()) {
+            member.name = longName;
+        }
+        else {
+            std::string prefix = readField(block + 345, 155);
+            std::string name = readField(block, 100);
+            member.name = prefix.empty() ? name : prefix + "/" + name;
+        }
+        if (!readPayload(size, member.data)) {
+            std::cerr << "Truncated tar entry: " << member.name << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (file_.gcount() > 0) {
+        std::cerr << "Truncated tar header, stopping" << std::endl;
+    }
+    return false;
+}
+
+bool isTarArchive(const std::string& path) {
+    return std::filesystem::is_regular_file(path) && std::filesystem::path(path).extension() == ".tar";
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct TarMember {
+    std::string name;
+    std::vector<uchar> data;
+};
+
+// Reads the regular-file members of a ustar/GNU/pax tar archive front to back, one at a time,
+// so an archive can be consumed without unpacking it or seeking
+class TarReader {
+public:
+    explicit TarReader(const std::string& archivePath);
+
+    bool isOpen() const { return file_.is_open(); }
+    bool next(TarMember& member);
+
+private:
+    bool readBlock(char* block);
+    bool readPayload(size_t size, std::vector<uchar>& data);
+    bool skipPayload(size_t size);
+
+    std::ifstream file_;
+    std::vector<char> buffer_;
+};
+
+bool isTarArchive(const std::string& path);
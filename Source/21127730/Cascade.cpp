@@ -0,0 +1,249 @@
+#include "Cascade.hpp"
+#include "Retrieval.hpp"
+#include "VideoIngest.hpp"
+#include <chrono>
+
+// A malformed stage rejects the whole spec: running a cascade with a stage silently missing changes its results
+std::vector<CascadeStage> parseCascadeStages(const std::string& spec) {
+    std::vector<CascadeStage> stages;
+    std::stringstream ss(spec);
+    std::string item;
+    while (getline(ss, item, ',')) {
+        size_t colon = item.find(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Invalid cascade stage (expected feature:keep): " << item << std::endl;
+            return {};
+        }
+
+        CascadeStage stage;
+        std::stringstream types(item.substr(0, colon));
+        std::string type;
+        while (getline(types, type, '+')) {
+            if (!type.empty()) {
+                stage.featureTypes.push_back(type);
+            }
+        }
+
+        std::string keep = item.substr(colon + 1);
+        size_t parsed = 0;
+        try {
+            stage.keep = std::stoi(keep, &parsed);
+        }
+        catch (const std::exception&) {
+            parsed = 0;
+        }
+        if (parsed == 0 || parsed != keep.size() || stage.keep <= 0 || stage.featureTypes.empty()) {
+            std::cerr << "Invalid cascade stage (expected feature:keep with keep > 0): " << item << std::endl;
+            return {};
+        }
+        stages.push_back(stage);
+    }
+    return stages;
+}
+
+// Local features are compared through their BoVW histograms, global features directly
+static Mat cascadeQueryFeature(const Mat& queryImage, const std::string& featureType, bool local, const std::string& dataset, std::string& path) {
+    Mat feature = extractFeaturesFromImage(queryImage, featureType);
+    if (local && !feature.empty()) {
+        Mat centers = readCodebookFromFile(path + featureType + "_codebook_" + dataset + ".xml");
+        if (centers.empty()) {
+            return Mat();
+        }
+        feature = CalculateQueryHistograms(feature, centers);
+    }
+    return feature;
+}
+
+// Number of RANSAC homography inliers between the query keypoints and a candidate image
+static int countInliers(const Ptr<SIFT>& sift, const std::vector<KeyPoint>& queryKeypoints, const Mat& queryDescriptors, const std::string& candidatePath) {
+    Mat candidate = cv::imread(candidatePath, cv::IMREAD_GRAYSCALE);
+    if (candidate.empty()) {
+        // Video segments have no file of their own; verify against the segment's first frame
+        candidate = readImageOrKeyframe(candidatePath);
+        if (!candidate.empty()) {
+            cv::cvtColor(candidate, candidate, cv::COLOR_BGR2GRAY);
+        }
+    }
+    if (candidate.empty() || queryDescriptors.empty()) {
+        return 0;
+    }
+
+    std::vector<KeyPoint> keypoints;
+    Mat descriptors;
+    sift->detectAndCompute(candidate, cv::noArray(), keypoints, descriptors);
+    if (descriptors.rows < 2) {
+        return 0;
+    }
+
+    // Lowe's ratio test before fitting the homography
+    std::vector<std::vector<DMatch>> knnMatches;
+    BFMatcher(cv::NORM_L2).knnMatch(queryDescriptors, descriptors, knnMatches, 2);
+
+    std::vector<Point2f> queryPoints, candidatePoints;
+    for (const auto& match : knnMatches) {
+        if (match.size() == 2 && match[0].distance < 0.75f * match[1].distance) {
+            queryPoints.push_back(queryKeypoints[match[0].queryIdx].pt);
+            candidatePoints.push_back(keypoints[match[0].trainIdx].pt);
+        }
+    }
+    if (queryPoints.size() < 4) {
+        return 0;
+    }
+
+    Mat mask;
+    Mat homography = cv::findHomography(queryPoints, candidatePoints, cv::RANSAC, 5.0, mask);
+    return homography.empty() ? 0 : cv::countNonZero(mask);
+}
+
+// Later stages only score the survivors, so their rows are read one by one from the row store by name
+// instead of parsing the whole store
+static size_t scoreCandidates(FeatureDatabase& db, const std::string& storeType, const std::string& dataset, std::string& path, const Mat& queryFeature, size_t fusedTypes, std::unordered_map<std::string, double>& stageScores) {
+    if (!db.ensureRowStore(storeType, dataset, path) && !db.saveRowStore(storeType, dataset, path)) {
+        std::cerr << "Cascade skipped " << storeType << ": no row store." << std::endl;
+        return 0;
+    }
+
+    RowStoreReader reader(db.rowStoreFilename(storeType, dataset, path));
+    if (!reader.isOpen() || static_cast<int>(queryFeature.total()) != reader.dims()) {
+        std::cerr << "Cascade skipped " << storeType << ": query does not match the stored feature size." << std::endl;
+        return 0;
+    }
+
+    std::unordered_map<std::string, uint64_t> rowsByName;
+    std::vector<std::string> names = reader.names();
+    for (uint64_t row = 0; row < names.size(); ++row) {
+        if (stageScores.count(names[row])) {
+            rowsByName.emplace(names[row], row);
+        }
+    }
+
+    Mat query;
+    queryFeature.reshape(1, 1).convertTo(query, CV_32F);
+    CosineKernel kernel = selectCosineKernel(reader.dims(), CV_32F);
+    Mat row(1, reader.dims(), CV_32F);
+    size_t scored = 0;
+    for (auto& entry : stageScores) {
+        auto found = rowsByName.find(entry.first);
+        if (found == rowsByName.end() || !reader.readRow(found->second, row.ptr<float>(0))) {
+            continue;
+        }
+        entry.second += kernel(query.ptr(), row.ptr(), reader.dims()) / fusedTypes;
+        ++scored;
+    }
+    return scored;
+}
+
+std::vector<std::string> retrievalCascade(const Mat& queryImage, FeatureDatabase db, const std::vector<CascadeStage>& stages, const std::set<std::string>& localFeatures, const std::string& dataset, int numResults, int verifyCount, std::string& path) {
+    std::vector<std::string> topSimilarImages;
+    std::vector<std::pair<std::string, double>> candidates;
+    for (const auto& stage : stages) {
+        if (stage.keep <= 0) {
+            std::cerr << "Cascade stages must keep at least one candidate." << std::endl;
+            return topSimilarImages;
+        }
+    }
+
+    for (size_t s = 0; s < stages.size(); ++s) {
+        const CascadeStage& stage = stages[s];
+        TRACE_SCOPE("cascade_stage");
+        auto start = std::chrono::high_resolution_clock::now();
+
+        // Survivors of the previous stage, or every stored image for the first stage
+        std::unordered_map<std::string, double> stageScores;
+        bool firstStage = (s == 0);
+        if (!firstStage) {
+            for (const auto& candidate : candidates) {
+                stageScores[candidate.first] = 0.0;
+            }
+        }
+
+        size_t scored = 0;
+        for (const auto& featureType : stage.featureTypes) {
+            bool local = localFeatures.count(featureType) > 0;
+            std::string storeType = local ? featureType + "_histogram" : featureType;
+
+            Mat queryFeature = cascadeQueryFeature(queryImage, featureType, local, dataset, path);
+            if (queryFeature.empty()) {
+                std::cerr << "Cascade stage " << s + 1 << " skipped " << storeType << ": no query feature." << std::endl;
+                continue;
+            }
+
+            if (!firstStage) {
+                scored += scoreCandidates(db, storeType, dataset, path, queryFeature, stage.featureTypes.size(), stageScores);
+                continue;
+            }
+
+            std::vector<std::pair<std::string, Mat>> databaseFeatures = db.loadFeatures(storeType, dataset, path);
+            if (databaseFeatures.empty()) {
+                std::cerr << "Cascade stage " << s + 1 << " skipped " << storeType << ": no features." << std::endl;
+                continue;
+            }
+
+            CosineKernel kernel;
+            Mat query = prepareQueryForStore(queryFeature, databaseFeatures, kernel);
+            for (const auto& dbFeature : databaseFeatures) {
+                double score = scoreWithKernel(kernel, query, dbFeature.second) / stage.featureTypes.size();
+                stageScores[dbFeature.first] += score;
+                ++scored;
+            }
+        }
+        TRACE_COUNTER("rows_scanned", scored);
+
+        candidates.assign(stageScores.begin(), stageScores.end());
+        int keep = (s + 1 == stages.size()) ? std::max(stage.keep, numResults) : stage.keep;
+        if (static_cast<int>(candidates.size()) > keep) {
+            std::partial_sort(candidates.begin(), candidates.begin() + keep, candidates.end(), [](const std::pair<std::string, double>& a, const std::pair<std::string, double>& b) {
+                return a.second > b.second;
+                });
+            candidates.resize(keep);
+        }
+        else {
+            std::sort(candidates.begin(), candidates.end(), [](const std::pair<std::string, double>& a, const std::pair<std::string, double>& b) {
+                return a.second > b.second;
+                });
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> duration = end - start;
+        std::cout << "Cascade stage " << s + 1 << ": scored " << scored << ", kept " << candidates.size()
+            << " in " << duration.count() << " seconds" << std::endl;
+    }
+
+    // Optional geometric check: re-rank the leading survivors by homography inliers
+    int verify = std::min(verifyCount, static_cast<int>(candidates.size()));
+    if (verify > 0) {
+        TRACE_SCOPE("cascade_verify");
+        auto start = std::chrono::high_resolution_clock::now();
+
+        Mat gray;
+        cv::cvtColor(queryImage, gray, cv::COLOR_BGR2GRAY);
+        std::vector<KeyPoint> queryKeypoints;
+        Mat queryDescriptors;
+        Ptr<SIFT> sift = SIFT::create();
+        sift->detectAndCompute(gray, cv::noArray(), queryKeypoints, queryDescriptors);
+
+        std::vector<std::pair<int, int>> inliers;
+        for (int i = 0; i < verify; ++i) {
+            inliers.push_back({ countInliers(sift, queryKeypoints, queryDescriptors, candidates[i].first), i });
+        }
+        // Stable on the cascade order when inlier counts tie
+        std::stable_sort(inliers.begin(), inliers.end(), [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+            return a.first > b.first;
+            });
+
+        std::vector<std::pair<std::string, double>> verified;
+        for (const auto& inlier : inliers) {
+            verified.push_back(candidates[inlier.second]);
+        }
+        std::copy(verified.begin(), verified.end(), candidates.begin());
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> duration = end - start;
+        std::cout << "Geometric verification of " << verify << " candidates in " << duration.count() << " seconds" << std::endl;
+    }
+
+    for (int i = 0; i < std::min(numResults, static_cast<int>(candidates.size())); ++i) {
+        topSimilarImages.push_back(candidates[i].first);
+    }
+    return topSimilarImages;
+}
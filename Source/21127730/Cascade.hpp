@@ -0,0 +1,18 @@
+#pragma once
+#include "Database.hpp"
+#include "Codebook.hpp"
+#include "Processing.hpp"
+#include "FeatureExtractor.hpp"
+#include <opencv2/opencv.hpp>
+#include <set>
+#include <vector>
+
+// One cascade stage: the stores it scores (fused with equal weights) and how many candidates survive it
+struct CascadeStage {
+    std::vector<std::string> featureTypes;
+    int keep;
+};
+
+// Parses "signature:200,correlogram:50,sift+histogram:20"
+std::vector<CascadeStage> parseCascadeStages(const std::string& spec);
+std::vector<std::string> retrievalCascade(const Mat& queryImage, FeatureDatabase db, const std::vector<CascadeStage>& stages, const std::set<std::string>& localFeatures, const std::string& dataset, int numResults, int verifyCount, std::string& path);
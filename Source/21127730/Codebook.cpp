@@ -1,6 +1,7 @@
 #include "Codebook.hpp"
 
 Mat ClusteringFeature(const std::vector<std::pair<std::string, Mat>>& features, int k) {
+    TRACE_SCOPE("kmeans");
     // Extract all feature descriptors into a separate vector
     std::vector<Mat> descriptors;
     for (const auto& feature : features) {
@@ -15,6 +16,8 @@ Mat ClusteringFeature(const std::vector<std::pair<std::string, Mat>>& features,
 
     // Convert descriptors to CV_32F type
     allDescriptors.convertTo(allDescriptors, CV_32F);
+    TRACE_COUNTER("descriptors_clustered", allDescriptors.rows);
+    MemoryHandle memory("kmeans/descriptors", matBytes(allDescriptors), allDescriptors.rows);
 
     // K-means clustering
     Mat labels;
@@ -26,6 +29,8 @@ Mat ClusteringFeature(const std::vector<std::pair<std::string, Mat>>& features,
 
 
 Mat CalculateQueryHistograms(Mat& feature, const Mat& centers) {
+    TRACE_SCOPE("encode_query");
+    TRACE_COUNTER("descriptors_encoded", feature.rows);
     // Initialize histogram
     Mat histogram = Mat::zeros(1, centers.rows, CV_32F);
     centers.convertTo(centers, CV_32F);
@@ -53,6 +58,7 @@ Mat CalculateQueryHistograms(Mat& feature, const Mat& centers) {
 }
 
 std::vector<std::pair<std::string, Mat>> CalculateHistograms(const std::vector<std::pair<std::string, Mat>>& features, const Mat& centers) {
+    TRACE_SCOPE("encode_database");
     std::vector<std::pair<std::string, Mat>> histograms;
 
     // Ensure centers are of type CV_32F
@@ -100,6 +106,7 @@ std::vector<std::pair<std::string, Mat>> CalculateHistograms(const std::vector<s
 
 
 void saveCodebookToFile(const Mat& centers, const std::string& filename) {
+    TRACE_SCOPE("codebook_save");
     cv::FileStorage fs(filename, cv::FileStorage::WRITE);
     if (!fs.isOpened()) {
         std::cerr << "Failed to open file: " << filename << std::endl;
@@ -110,6 +117,7 @@ void saveCodebookToFile(const Mat& centers, const std::string& filename) {
 }
 
 Mat readCodebookFromFile(const std::string& filename) {
+    TRACE_SCOPE("codebook_load");
     cv::FileStorage fs(filename, cv::FileStorage::READ);
     if (!fs.isOpened()) {
         std::cerr << "Failed to open file: " << filename << std::endl;
@@ -1,8 +1,13 @@
 #pragma once
+#ifdef _WIN32
 #include "windows.h "
+#endif
+#include "Trace.hpp"
+#include "Memory.hpp"
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/videoio.hpp>
+#include <filesystem>
 #include <vector>
 
 using namespace cv;
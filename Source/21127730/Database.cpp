@@ -2,37 +2,254 @@
 #include <iostream>
 #include <filesystem>
 
-bool FeatureDatabase::saveFeatures(const std::vector<std::pair<std::string, Mat>>& features, const std::string& featureType, const std::string& dataset, std::string path) {
-    std::string filename = path + featureType + "_" + dataset + ".xml";
-    cv::FileStorage fs(filename, cv::FileStorage::WRITE | cv::FileStorage::FORMAT_XML);
+// Records go to a temporary file that replaces the store only on an explicit close(), so a crash, an early
+// return or an exception while writing leaves the previous store intact
+FeatureWriter::FeatureWriter(const std::string& filename, double sparseDensity) : filename_(filename), sparseDensity_(sparseDensity) {
+    fs_.open(temporaryFilename(), cv::FileStorage::WRITE | cv::FileStorage::FORMAT_XML);
+    if (!fs_.isOpened()) {
+        std::cerr << "Failed to open file for writing: " << cv::format("%s", temporaryFilename().c_str()) << std::endl;
+        return;
+    }
+    fs_ << "features" << "[";
+}
 
-    if (!fs.isOpened()) {
-        std::cerr << "Failed to open file for writing: " << cv::format("%s", filename.c_str()) << std::endl;
+FeatureWriter::~FeatureWriter() {
+    if (fs_.isOpened() || finished_) {
+        fs_.release();
+        std::error_code error;
+        std::filesystem::remove(temporaryFilename(), error);
+    }
+}
+
+void FeatureWriter::write(const std::string& name, const Mat& feature) {
+    if (!fs_.isOpened()) {
+        return;
+    }
+
+    // Start a map for each feature
+    fs_ << "{";
+    fs_ << "filename" << name;
+    if (sparseDensity_ > 0 && feature.rows == 1 && feature.channels() == 1 && feature.depth() == CV_32F
+        && cv::countNonZero(feature) < sparseDensity_ * feature.total()) {
+        SparseVector sparse = toSparse(feature);
+        fs_ << "dims" << sparse.dims;
+        fs_ << "index" << Mat(sparse.indices, true).reshape(1, 1);
+        fs_ << "value" << Mat(sparse.values, true).reshape(1, 1);
+    }
+    else {
+        fs_ << "feature" << feature;
+    }
+    // End the map
+    fs_ << "}";
+}
+
+bool FeatureWriter::finish() {
+    if (!fs_.isOpened()) {
+        return finished_;
+    }
+    fs_ << "]";
+    fs_.release();
+    finished_ = true;
+    return true;
+}
+
+bool FeatureWriter::commit() {
+    if (!finished_) {
         return false;
     }
+    finished_ = false;
 
-    fs << "features" << "[";
-    for (const auto& feature_pair : features) {
-        const std::string& filename = feature_pair.first;
-        const Mat& feature = feature_pair.second;
+    std::error_code error;
+    std::filesystem::rename(temporaryFilename(), filename_, error);
+    if (error) {
+        std::cerr << "Failed to replace " << filename_ << ": " << error.message() << std::endl;
+        std::filesystem::remove(temporaryFilename(), error);
+        return false;
+    }
+    return true;
+}
+
+static SparseVector readSparseNode(const cv::FileNode& node) {
+    SparseVector sparse;
+    Mat indices, values;
+    node["dims"] >> sparse.dims;
+    node["index"] >> indices;
+    node["value"] >> values;
+
+    if (!indices.empty()) {
+        sparse.indices.assign(indices.ptr<int>(0), indices.ptr<int>(0) + indices.total());
+        sparse.values.assign(values.ptr<float>(0), values.ptr<float>(0) + values.total());
+    }
+    return sparse;
+}
 
-        // Start a map for each feature
-        fs << "{";
-        fs << "filename" << filename;
-        fs << "feature" << feature;
-        // End the map
-        fs << "}";
+// Sparse rows are expanded so every existing dense path keeps working
+static void readFeatureNode(const cv::FileNode& node, std::string& imageFilename, Mat& feature) {
+    node["filename"] >> imageFilename;
+    if (!node["index"].empty()) {
+        feature = toDense(readSparseNode(node));
+    }
+    else {
+        node["feature"] >> feature;
     }
-    fs << "]";
+}
 
-    fs.release();
+FeatureStoreReader::FeatureStoreReader(const std::string& filename) : file_(filename, std::ios::binary), filename_(filename) {
+}
+
+// Cuts the next "<_>...</_>" record out of the file, reading 1 MB blocks as needed
+bool FeatureStoreReader::appendRecord(std::string& text) {
+    static const std::string recordOpen = "<_>";
+    static const std::string recordClose = "</_>";
+    static const size_t blockSize = size_t(1) << 20;
+
+    while (!done_) {
+        size_t start = buffer_.find(recordOpen, position_);
+        size_t stop = start == std::string::npos ? std::string::npos : buffer_.find(recordClose, start);
+        if (stop != std::string::npos) {
+            stop += recordClose.size();
+            text.append(buffer_, start, stop - start).push_back('\n');
+            position_ = stop;
+            return true;
+        }
+        if (start == std::string::npos && buffer_.find("</features>", position_) != std::string::npos) {
+            done_ = true;
+            break;
+        }
+        if (!file_) {
+            std::cerr << "Truncated features file: " << filename_ << std::endl;
+            done_ = true;
+            failed_ = true;
+            break;
+        }
+
+        // Keep the unfinished record, or a few bytes in case a tag straddles the block boundary
+        size_t keep = start != std::string::npos ? start : std::max(position_, buffer_.size() > 16 ? buffer_.size() - 16 : 0);
+        buffer_.erase(0, keep);
+        position_ = 0;
+
+        size_t filled = buffer_.size();
+        buffer_.resize(filled + blockSize);
+        file_.read(&buffer_[filled], blockSize);
+        buffer_.resize(filled + static_cast<size_t>(file_.gcount()));
+    }
+    return false;
+}
+
+bool FeatureStoreReader::next(std::vector<std::pair<std::string, Mat>>& chunk, size_t maxTextBytes) {
+    chunk.clear();
+    if (!file_.is_open()) {
+        return false;
+    }
+
+    // The records are parsed as a small standalone document so the decoding matches loadFeatures exactly
+    std::string text = "<?xml version=\"1.0\"?>\n<opencv_storage>\n<features>\n";
+    size_t records = 0;
+    while ((records == 0 || text.size() < maxTextBytes) && appendRecord(text)) {
+        ++records;
+    }
+    if (records == 0) {
+        return false;
+    }
+    text += "</features>\n</opencv_storage>\n";
+
+    cv::FileStorage fs(text, cv::FileStorage::READ | cv::FileStorage::MEMORY | cv::FileStorage::FORMAT_XML);
+    cv::FileNode featuresNode = fs.isOpened() ? fs["features"] : cv::FileNode();
+    if (featuresNode.type() != cv::FileNode::SEQ) {
+        std::cerr << "Invalid format in the features file: " << filename_ << std::endl;
+        done_ = true;
+        failed_ = true;
+        return false;
+    }
+
+    chunk.reserve(records);
+    for (auto it = featuresNode.begin(); it != featuresNode.end(); ++it) {
+        std::string imageFilename;
+        Mat feature;
+        readFeatureNode(*it, imageFilename, feature);
+        chunk.emplace_back(imageFilename, feature);
+    }
     return true;
 }
 
+std::string FeatureDatabase::featureFilename(const std::string& featureType, const std::string& dataset, std::string path) const {
+    return path + featureType + "_" + dataset + ".xml";
+}
+
+std::string FeatureDatabase::rowStoreFilename(const std::string& featureType, const std::string& dataset, std::string path) const {
+    return path + featureType + "_" + dataset + ".rows";
+}
+
+std::string FeatureDatabase::hashIndexFilename(const std::string& dataset, std::string path) const {
+    return path + "phash_" + dataset + ".mih";
+}
+
+std::string FeatureDatabase::chunkIndexFilename(const std::string& featureType, const std::string& dataset, std::string path) const {
+    return path + featureType + "_" + dataset + ".chunks";
+}
+
+bool FeatureDatabase::saveRowStore(const std::string& featureType, const std::string& dataset, std::string path) {
+    TRACE_SCOPE("db_save_rows");
+    RowStoreWriter writer(rowStoreFilename(featureType, dataset, path), sourceStamp(featureFilename(featureType, dataset, path)));
+    if (!writer.isOpen()) {
+        return false;
+    }
+
+    size_t chunkBytes = memoryCeiling > 0 ? memoryCeiling / 2 : (size_t(64) << 20);
+    bool loaded = forEachFeatureChunk(featureType, dataset, path, chunkBytes, [&](std::vector<std::pair<std::string, Mat>>& chunk) {
+        for (const auto& feature : chunk) {
+            writer.write(feature.first, feature.second);
+        }
+    });
+    // A store that failed to load part way through leaves the previous row store in place
+    return loaded && writer.close();
+}
+
+// A row store whose stamp no longer matches its XML store was left behind by a rewrite and is rebuilt
+bool FeatureDatabase::ensureRowStore(const std::string& featureType, const std::string& dataset, std::string path) {
+    std::string filename = rowStoreFilename(featureType, dataset, path);
+    if (!std::filesystem::exists(filename)) {
+        return false;
+    }
+
+    {
+        RowStoreReader reader(filename);
+        if (reader.isOpen() && reader.source() == sourceStamp(featureFilename(featureType, dataset, path))) {
+            return true;
+        }
+    }
+    std::cout << "Row store is out of date, rebuilding " << filename << std::endl;
+    return saveRowStore(featureType, dataset, path);
+}
+
+bool FeatureDatabase::saveFeatures(const std::vector<std::pair<std::string, Mat>>& features, const std::string& featureType, const std::string& dataset, std::string path) {
+    TRACE_SCOPE("db_save");
+    FeatureWriter writer(featureFilename(featureType, dataset, path), sparseDensity);
+    if (!writer.isOpen()) {
+        return false;
+    }
+
+    for (const auto& feature_pair : features) {
+        writer.write(feature_pair.first, feature_pair.second);
+    }
+    return writer.close();
+}
+
+// The XML text of a store is always larger than its decoded rows, so the file size is a safe upper bound
+bool FeatureDatabase::exceedsMemoryCeiling(const std::string& featureType, const std::string& dataset, std::string path) {
+    if (memoryCeiling == 0) {
+        return false;
+    }
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(featureFilename(featureType, dataset, path), error);
+    return !error && size > memoryCeiling;
+}
+
 std::vector<std::pair<std::string, Mat>> FeatureDatabase::loadFeatures(const std::string& featureType, const std::string& dataset, std::string path) {
+    TRACE_SCOPE("db_load");
     std::vector<std::pair<std::string, Mat>> features;
 
-    std::string filename = path + featureType + "_" + dataset + ".xml";
+    std::string filename = featureFilename(featureType, dataset, path);
     cv::FileStorage fs(filename, cv::FileStorage::READ | cv::FileStorage::FORMAT_XML);
 
     if (!fs.isOpened()) {
@@ -49,18 +266,307 @@ std::vector<std::pair<std::string, Mat>> FeatureDatabase::loadFeatures(const std
     for (auto it = featuresNode.begin(); it != featuresNode.end(); ++it) {
         std::string imageFilename;
         Mat feature;
-
-        cv::FileNode node = *it;
-
-        node["filename"] >> imageFilename;
-        node["feature"] >> feature;
-
+        readFeatureNode(*it, imageFilename, feature);
         features.emplace_back(imageFilename, feature);
     }
 
     fs.release();
+
+    std::error_code error;
+    TRACE_COUNTER("bytes_loaded", std::filesystem::file_size(filename, error));
+    TRACE_COUNTER("rows_loaded", features.size());
     return features;
 }
 
+bool FeatureDatabase::forEachFeatureChunk(const std::string& featureType, const std::string& dataset, std::string path, size_t chunkBytes, const std::function<void(std::vector<std::pair<std::string, Mat>>&)>& consume) {
+    TRACE_SCOPE("db_load_chunked");
+    std::string filename = featureFilename(featureType, dataset, path);
+    FeatureStoreReader reader(filename);
+
+    if (!reader.isOpen()) {
+        std::cerr << "Failed to open file for reading: " << cv::format("%s", filename.c_str()) << std::endl;
+        return false;
+    }
+
+    // While a chunk is parsed its text, the parsed tree and the decoded rows are all alive, so each gets a third
+    MemoryHandle memory("chunk/" + featureType, 0);
+    std::vector<std::pair<std::string, Mat>> chunk;
+    size_t rows = 0;
+    while (reader.next(chunk, std::max<size_t>(chunkBytes / 3, 1))) {
+        memory.update(featureBytes(chunk) + nameBytes(chunk), chunk.size());
+        rows += chunk.size();
+        consume(chunk);
+    }
+
+    TRACE_COUNTER("rows_loaded", rows);
+    return !reader.failed();
+}
+
+// Thumbnail cache layout: "VIRT" | uint32 version | int32 size | count | { nameLength | name | dataLength | JPEG bytes } * count
+const uint32_t THUMBNAIL_VERSION = 2;
+const std::streamoff THUMBNAIL_COUNT_OFFSET = 12;
+
+// Written to a temporary file like the feature stores and renamed over the cache on close()
+ThumbnailWriter::ThumbnailWriter(const std::string& filename, int thumbnailSize) : file_(filename + ".tmp", std::ios::binary), filename_(filename) {
+    if (!file_.is_open()) {
+        std::cerr << "Failed to open file for writing: " << filename << ".tmp" << std::endl;
+        return;
+    }
+
+    int32_t size = thumbnailSize;
+    file_.write("VIRT", 4);
+    file_.write(reinterpret_cast<const char*>(&THUMBNAIL_VERSION), sizeof(THUMBNAIL_VERSION));
+    file_.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    file_.write(reinterpret_cast<const char*>(&count_), sizeof(count_));
+}
+
+ThumbnailWriter::~ThumbnailWriter() {
+    if (file_.is_open() || finished_) {
+        file_.close();
+        std::error_code error;
+        std::filesystem::remove(filename_ + ".tmp", error);
+    }
+}
+
+void ThumbnailWriter::write(const std::string& name, const std::vector<uchar>& data) {
+    if (!file_.is_open()) {
+        return;
+    }
+
+    uint32_t nameLength = static_cast<uint32_t>(name.size());
+    uint32_t dataLength = static_cast<uint32_t>(data.size());
+
+    file_.write(reinterpret_cast<const char*>(&nameLength), sizeof(nameLength));
+    file_.write(name.data(), nameLength);
+    file_.write(reinterpret_cast<const char*>(&dataLength), sizeof(dataLength));
+    file_.write(reinterpret_cast<const char*>(data.data()), dataLength);
+    ++count_;
+}
+
+bool ThumbnailWriter::finish() {
+    if (!file_.is_open()) {
+        return finished_;
+    }
+
+    file_.seekp(THUMBNAIL_COUNT_OFFSET);
+    file_.write(reinterpret_cast<const char*>(&count_), sizeof(count_));
+
+    bool ok = static_cast<bool>(file_);
+    file_.close();
+    if (!ok) {
+        std::cerr << "Failed to write thumbnails file: " << filename_ << std::endl;
+        std::error_code error;
+        std::filesystem::remove(filename_ + ".tmp", error);
+        return false;
+    }
+    finished_ = true;
+    return true;
+}
+
+bool ThumbnailWriter::commit() {
+    if (!finished_) {
+        return false;
+    }
+    finished_ = false;
+
+    std::error_code error;
+    std::filesystem::rename(filename_ + ".tmp", filename_, error);
+    if (error) {
+        std::cerr << "Failed to replace " << filename_ << ": " << error.message() << std::endl;
+        std::filesystem::remove(filename_ + ".tmp", error);
+        return false;
+    }
+    return true;
+}
+
+std::string FeatureDatabase::thumbnailFilename(const std::string& dataset, std::string path) const {
+    return path + "thumbnails_" + dataset + ".bin";
+}
+
+bool FeatureDatabase::saveThumbnails(const std::vector<std::pair<std::string, std::vector<uchar>>>& thumbnails, int thumbnailSize, const std::string& dataset, std::string path) {
+    ThumbnailWriter writer(thumbnailFilename(dataset, path), thumbnailSize);
+    if (!writer.isOpen()) {
+        return false;
+    }
+
+    for (const auto& thumbnail : thumbnails) {
+        writer.write(thumbnail.first, thumbnail.second);
+    }
+    return writer.close();
+}
+
+// Reads the header; false for caches in another format, including the earlier one without a size
+static bool readThumbnailHeader(std::ifstream& file, int32_t& size, uint32_t& count) {
+    char magic[4];
+    uint32_t version = 0;
+    file.read(magic, 4);
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    file.read(reinterpret_cast<char*>(&size), sizeof(size));
+    file.read(reinterpret_cast<char*>(&count), sizeof(count));
+    return file && std::string(magic, 4) == "VIRT" && version == THUMBNAIL_VERSION && size > 0;
+}
+
+int FeatureDatabase::thumbnailCacheSize(const std::string& dataset, std::string path) const {
+    std::ifstream file(thumbnailFilename(dataset, path), std::ios::binary);
+    int32_t size = 0;
+    uint32_t count = 0;
+    return file.is_open() && readThumbnailHeader(file, size, count) ? size : 0;
+}
+
+std::unordered_map<std::string, std::vector<uchar>> FeatureDatabase::loadThumbnails(const std::string& dataset, std::string path, int thumbnailSize) {
+    TRACE_SCOPE("thumbnail_load");
+    std::unordered_map<std::string, std::vector<uchar>> thumbnails;
+
+    std::string filename = thumbnailFilename(dataset, path);
+    std::ifstream file(filename, std::ios::binary);
+
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file for reading: " << filename << std::endl;
+        return thumbnails;
+    }
+
+    int32_t size = 0;
+    uint32_t count = 0;
+    if (!readThumbnailHeader(file, size, count)) {
+        std::cerr << "Invalid format in the thumbnails file, re-run extract to rebuild it." << std::endl;
+        return thumbnails;
+    }
+    if (thumbnailSize > 0 && size != thumbnailSize) {
+        std::cerr << "Thumbnails were cached at " << size << " px but " << thumbnailSize << " px are configured, re-run extract to rebuild them." << std::endl;
+        return thumbnails;
+    }
+
+    thumbnails.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t nameLength = 0;
+        uint32_t dataLength = 0;
+
+        file.read(reinterpret_cast<char*>(&nameLength), sizeof(nameLength));
+        std::string imageFilename(nameLength, '\0');
+        file.read(&imageFilename[0], nameLength);
+
+        file.read(reinterpret_cast<char*>(&dataLength), sizeof(dataLength));
+        std::vector<uchar> data(dataLength);
+        file.read(reinterpret_cast<char*>(data.data()), dataLength);
+
+        if (!file) {
+            std::cerr << "Truncated thumbnails file: " << filename << std::endl;
+            break;
+        }
+        thumbnails.emplace(std::move(imageFilename), std::move(data));
+    }
+
+    file.close();
+    return thumbnails;
+}
+
+FeatureMatrix packFeatures(const std::vector<std::pair<std::string, Mat>>& features) {
+    FeatureMatrix matrix;
+    if (features.empty()) {
+        return matrix;
+    }
+
+    int dims = static_cast<int>(features.front().second.total());
+    matrix.data.create(static_cast<int>(features.size()), dims, CV_32F);
+    matrix.names.reserve(features.size());
+
+    int row = 0;
+    for (const auto& feature : features) {
+        if (static_cast<int>(feature.second.total()) != dims || feature.second.channels() != 1) {
+            std::cerr << "Skipping feature with mismatched size: " << feature.first << std::endl;
+            continue;
+        }
+
+        Mat destination = matrix.data.row(row);
+        feature.second.reshape(1, 1).convertTo(destination, CV_32F);
+        matrix.names.push_back(feature.first);
+        ++row;
+    }
+
+    matrix.data = matrix.data.rowRange(0, row);
+    matrix.norms = rowNorms(matrix.data);
+    return matrix;
+}
+
+std::vector<double> rowNorms(const Mat& data) {
+    std::vector<double> norms(data.rows);
+    for (int row = 0; row < data.rows; ++row) {
+        norms[row] = cv::norm(data.row(row));
+    }
+    return norms;
+}
+
+MemoryHandle trackFeatureMatrix(const std::string& component, const FeatureMatrix& matrix) {
+    size_t bytes = matBytes(matrix.data) + matrix.names.capacity() * sizeof(std::string) + matrix.norms.capacity() * sizeof(double);
+    for (const auto& name : matrix.names) {
+        bytes += name.capacity() >= sizeof(std::string) ? name.capacity() + 1 : 0;
+    }
+    return MemoryHandle(component, bytes, matrix.names.size());
+}
+
+// Loads a store keeping sparse rows sparse; dense rows that fall under the density threshold are sparsified too
+SparseFeatureStore FeatureDatabase::loadSparseFeatures(const std::string& featureType, const std::string& dataset, std::string path) {
+    TRACE_SCOPE("db_load");
+    SparseFeatureStore store;
+
+    std::string filename = featureFilename(featureType, dataset, path);
+    cv::FileStorage fs(filename, cv::FileStorage::READ | cv::FileStorage::FORMAT_XML);
+
+    if (!fs.isOpened()) {
+        std::cerr << "Failed to open file for reading: " << cv::format("%s", filename.c_str()) << std::endl;
+        return store;
+    }
+
+    cv::FileNode featuresNode = fs["features"];
+    if (featuresNode.type() != cv::FileNode::SEQ) {
+        std::cerr << "Invalid format in the features file." << std::endl;
+        return store;
+    }
+
+    for (auto it = featuresNode.begin(); it != featuresNode.end(); ++it) {
+        cv::FileNode node = *it;
+        std::string imageFilename;
+        node["filename"] >> imageFilename;
+
+        SparseVector sparse;
+        Mat dense;
+        if (!node["index"].empty()) {
+            sparse = readSparseNode(node);
+        }
+        else {
+            Mat feature;
+            node["feature"] >> feature;
+            feature.reshape(1, 1).convertTo(dense, CV_32F);
+            if (sparseDensity > 0 && cv::countNonZero(dense) < sparseDensity * dense.total()) {
+                sparse = toSparse(dense);
+                dense.release();
+            }
+        }
 
+        int dims = dense.empty() ? sparse.dims : dense.cols;
+        if (store.dims == 0) {
+            store.dims = dims;
+        }
+        else if (dims != store.dims) {
+            std::cerr << "Skipping feature with mismatched size: " << imageFilename << std::endl;
+            continue;
+        }
 
+        store.norms.push_back(dense.empty() ? sparseNorm(sparse) : cv::norm(dense));
+        store.sparseRows += dense.empty() ? 1 : 0;
+        store.names.push_back(imageFilename);
+        store.sparse.push_back(std::move(sparse));
+        store.dense.push_back(dense);
+    }
+
+    fs.release();
+    TRACE_COUNTER("rows_loaded", store.names.size());
+    TRACE_COUNTER("sparse_rows_loaded", store.sparseRows);
+
+    size_t bytes = store.norms.capacity() * sizeof(double) + store.names.capacity() * sizeof(std::string);
+    for (size_t i = 0; i < store.names.size(); ++i) {
+        bytes += matBytes(store.dense[i]) + store.sparse[i].indices.capacity() * sizeof(int) + store.sparse[i].values.capacity() * sizeof(float);
+    }
+    store.memory = MemoryHandle("sparse/" + featureType, bytes, store.names.size());
+    return store;
+}
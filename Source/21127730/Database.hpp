@@ -1,15 +1,153 @@
 #pragma once
+#ifdef _WIN32
 #include "windows.h "
+#endif
+#include "Trace.hpp"
+#include "SimilarityKernels.hpp"
+#include "Memory.hpp"
+#include "RowStore.hpp"
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/videoio.hpp>
 #include <vector>
 #include <fstream>
+#include <functional>
+#include <unordered_map>
 
 using namespace cv;
 
+// Feature store packed into one contiguous CV_32F matrix, one image per row
+struct FeatureMatrix {
+    std::vector<std::string> names;
+    Mat data;
+    // L2 norm of each row, computed once when the store is packed
+    std::vector<double> norms;
+};
+
+FeatureMatrix packFeatures(const std::vector<std::pair<std::string, Mat>>& features);
+std::vector<double> rowNorms(const Mat& data);
+
+// Feature store keeping each row in whichever form is cheaper: sparse rows leave dense empty and vice versa
+struct SparseFeatureStore {
+    std::vector<std::string> names;
+    std::vector<SparseVector> sparse;
+    std::vector<Mat> dense;
+    std::vector<double> norms;
+    int dims = 0;
+    size_t sparseRows = 0;
+    MemoryHandle memory;
+};
+
+MemoryHandle trackFeatureMatrix(const std::string& component, const FeatureMatrix& matrix);
+
+// Writes a feature file one entry at a time, so a store never has to be held in memory to be saved
+class FeatureWriter {
+public:
+    FeatureWriter(const std::string& filename, double sparseDensity);
+    ~FeatureWriter();
+
+    bool isOpen() const { return fs_.isOpened(); }
+    void write(const std::string& name, const Mat& feature);
+    // Finishes the temporary file and renames it over the store; false if either step failed.
+    // A writer destroyed without close() discards what it wrote.
+    bool close() { return finish() && commit(); }
+    // The two halves of close(), so several stores can all be finished before any of them is replaced
+    bool finish();
+    bool commit();
+
+    FeatureWriter(const FeatureWriter&) = delete;
+    FeatureWriter& operator=(const FeatureWriter&) = delete;
+
+private:
+    std::string temporaryFilename() const { return filename_ + ".tmp"; }
+
+    cv::FileStorage fs_;
+    std::string filename_;
+    double sparseDensity_;
+    bool finished_ = false;
+};
+
+// Reads a feature file record by record, so only the rows of the current chunk are ever resident
+class FeatureStoreReader {
+public:
+    explicit FeatureStoreReader(const std::string& filename);
+
+    bool isOpen() const { return file_.is_open(); }
+    // True once the file turned out to be truncated or malformed part way through
+    bool failed() const { return failed_; }
+    // Decodes the next records, about maxTextBytes of XML worth; returns false once the store is exhausted
+    bool next(std::vector<std::pair<std::string, Mat>>& chunk, size_t maxTextBytes);
+
+private:
+    bool appendRecord(std::string& text);
+
+    std::ifstream file_;
+    std::string filename_;
+    std::string buffer_;
+    size_t position_ = 0;
+    bool done_ = false;
+    bool failed_ = false;
+};
+
+// Appends thumbnails to the cache one at a time; the count in the header is patched and the cache replaced
+// on close(), a writer destroyed without it discards what it wrote
+class ThumbnailWriter {
+public:
+    ThumbnailWriter(const std::string& filename, int thumbnailSize);
+    ~ThumbnailWriter();
+
+    bool isOpen() const { return file_.is_open(); }
+    void write(const std::string& name, const std::vector<uchar>& data);
+    bool close() { return finish() && commit(); }
+    bool finish();
+    bool commit();
+
+    ThumbnailWriter(const ThumbnailWriter&) = delete;
+    ThumbnailWriter& operator=(const ThumbnailWriter&) = delete;
+
+private:
+    std::ofstream file_;
+    std::string filename_;
+    uint32_t count_ = 0;
+    bool finished_ = false;
+};
+
 class FeatureDatabase {
 public:
+    // Single-row features whose fraction of non-zero bins is below this density are stored sparse (0 disables)
+    void setSparseDensity(double density) { sparseDensity = density; }
+    double getSparseDensity() const { return sparseDensity; }
+    // Upper bound in bytes for a single in-memory store; larger stores are processed in chunks (0 disables)
+    void setMemoryCeiling(size_t bytes) { memoryCeiling = bytes; }
+    size_t getMemoryCeiling() const { return memoryCeiling; }
+    bool exceedsMemoryCeiling(const std::string& featureType, const std::string& dataset, std::string path);
+    // Chunk size for out-of-core scans of the binary row store (0 scans only when the ceiling forces it)
+    void setStreamChunkBytes(size_t bytes) { streamChunkBytes = bytes; }
+    size_t getStreamChunkBytes() const { return streamChunkBytes; }
+
     bool saveFeatures(const std::vector<std::pair<std::string, Mat>>& features, const std::string& featureType, const std::string& dataset, std::string path);
     std::vector<std::pair<std::string, Mat>> loadFeatures(const std::string& featureType, const std::string& dataset, std::string path);
+    // Thumbnails are kept JPEG-encoded in a single binary file next to the feature files, together with their size
+    bool saveThumbnails(const std::vector<std::pair<std::string, std::vector<uchar>>>& thumbnails, int thumbnailSize, const std::string& dataset, std::string path);
+    // An empty map when the cache was built at another size than thumbnailSize (0 accepts any size)
+    std::unordered_map<std::string, std::vector<uchar>> loadThumbnails(const std::string& dataset, std::string path, int thumbnailSize);
+    // Size the thumbnail cache was built at, 0 when there is no readable cache
+    int thumbnailCacheSize(const std::string& dataset, std::string path) const;
+    SparseFeatureStore loadSparseFeatures(const std::string& featureType, const std::string& dataset, std::string path);
+    std::string thumbnailFilename(const std::string& dataset, std::string path) const;
+    std::string featureFilename(const std::string& featureType, const std::string& dataset, std::string path) const;
+    std::string rowStoreFilename(const std::string& featureType, const std::string& dataset, std::string path) const;
+    std::string hashIndexFilename(const std::string& dataset, std::string path) const;
+    std::string chunkIndexFilename(const std::string& featureType, const std::string& dataset, std::string path) const;
+    // Converts the XML store into the binary row store used by streamed scans, one chunk at a time
+    bool saveRowStore(const std::string& featureType, const std::string& dataset, std::string path);
+    // True when a row store matching the current XML store is on disk; a stale one is rebuilt first
+    bool ensureRowStore(const std::string& featureType, const std::string& dataset, std::string path);
+    // Streams a store in chunks of roughly chunkBytes; each chunk is handed over and dropped before the next is read
+    bool forEachFeatureChunk(const std::string& featureType, const std::string& dataset, std::string path, size_t chunkBytes, const std::function<void(std::vector<std::pair<std::string, Mat>>&)>& consume);
+
+private:
+    double sparseDensity = 0.0;
+    size_t memoryCeiling = 0;
+    size_t streamChunkBytes = 0;
 };
\ No newline at end of file
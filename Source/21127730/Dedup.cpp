@@ -0,0 +1,275 @@
+#include "Dedup.hpp"
+#include <cfloat>
+#include <numeric>
+#include <unordered_set>
+
+// Union-find over store rows with path halving and union by size
+class DisjointSet {
+public:
+    explicit DisjointSet(int count) : parent(count), size(count, 1) {
+        std::iota(parent.begin(), parent.end(), 0);
+    }
+
+    int find(int x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    }
+
+    void unite(int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+            return;
+        }
+        if (size[a] < size[b]) {
+            std::swap(a, b);
+        }
+        parent[b] = a;
+        size[a] += size[b];
+    }
+
+private:
+    std::vector<int> parent;
+    std::vector<int> size;
+};
+
+// All-pairs cosine self-join. For unit rows cos(x, y) >= t exactly when |x - y| <= sqrt(2 - 2t), and
+// projecting onto orthonormal directions never lengthens x - y. Rows are projected onto their leading
+// principal directions and tiled along the first one; tile pairs whose bounding boxes in that space are
+// further apart than the radius cannot hold a duplicate and are skipped without a gemm.
+std::vector<DuplicatePair> findDuplicatePairs(const FeatureMatrix& store, double threshold, int tileRows, JoinStats* stats) {
+    TRACE_SCOPE("self_join");
+    std::vector<DuplicatePair> pairs;
+    int count = store.data.rows;
+    if (count < 2) {
+        return pairs;
+    }
+
+    // Normalize every row
+    Mat normalized(count, store.data.cols, CV_32F);
+    for (int i = 0; i < count; ++i) {
+        Mat row = normalized.row(i);
+        store.data.row(i).convertTo(row, CV_32F);
+        double norm = cv::norm(row);
+        if (norm > 0) {
+            row /= norm;
+        }
+    }
+
+    Mat projected;
+    {
+        TRACE_SCOPE("self_join_project");
+        cv::PCA pca(normalized, cv::noArray(), cv::PCA::DATA_AS_ROW, std::min(8, store.data.cols));
+        pca.project(normalized).convertTo(projected, CV_32F);
+    }
+    int projectedDims = projected.cols;
+
+    // Order rows along the first principal direction so each tile covers a narrow slab of it
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return projected.at<float>(a, 0) < projected.at<float>(b, 0); });
+
+    Mat sorted(count, store.data.cols, CV_32F);
+    for (int i = 0; i < count; ++i) {
+        Mat row = sorted.row(i);
+        normalized.row(order[i]).copyTo(row);
+    }
+    normalized.release();
+
+    tileRows = std::max(1, tileRows);
+    int numTiles = (count + tileRows - 1) / tileRows;
+
+    // Bounding box of every tile in the projected space
+    Mat tileLow(numTiles, projectedDims, CV_32F, Scalar::all(FLT_MAX));
+    Mat tileHigh(numTiles, projectedDims, CV_32F, Scalar::all(-FLT_MAX));
+    for (int i = 0; i < count; ++i) {
+        const float* point = projected.ptr<float>(order[i]);
+        float* low = tileLow.ptr<float>(i / tileRows);
+        float* high = tileHigh.ptr<float>(i / tileRows);
+        for (int d = 0; d < projectedDims; ++d) {
+            low[d] = std::min(low[d], point[d]);
+            high[d] = std::max(high[d], point[d]);
+        }
+    }
+
+    // A little slack covers the float rounding of the projection
+    double radius = std::sqrt(std::max(0.0, 2.0 - 2.0 * threshold)) + 1e-4;
+    double radiusSquared = radius * radius;
+
+    // Each worker owns a band of row tiles and joins it against itself and every later tile
+    std::mutex pairsMutex;
+    std::atomic<long long> skippedTiles(0);
+    cv::parallel_for_(cv::Range(0, numTiles), [&](const cv::Range& range) {
+        std::vector<DuplicatePair> localPairs;
+        long long skipped = 0;
+        Mat scores;
+        for (int a = range.start; a < range.end; ++a) {
+            Mat tileA = sorted.rowRange(a * tileRows, std::min((a + 1) * tileRows, count));
+            const float* lowA = tileLow.ptr<float>(a);
+            const float* highA = tileHigh.ptr<float>(a);
+
+            for (int b = a; b < numTiles; ++b) {
+                const float* lowB = tileLow.ptr<float>(b);
+                const float* highB = tileHigh.ptr<float>(b);
+
+                // Tiles are sorted along the first direction, so once one is out of reach all later ones are
+                if (lowB[0] - highA[0] > radius) {
+                    skipped += numTiles - b;
+                    break;
+                }
+                double gap = 0.0;
+                for (int d = 0; d < projectedDims; ++d) {
+                    double apart = std::max(0.0, std::max<double>(lowB[d] - highA[d], lowA[d] - highB[d]));
+                    gap += apart * apart;
+                }
+                if (gap > radiusSquared) {
+                    ++skipped;
+                    continue;
+                }
+
+                Mat tileB = sorted.rowRange(b * tileRows, std::min((b + 1) * tileRows, count));
+                cv::gemm(tileA, tileB, 1.0, cv::noArray(), 0.0, scores, cv::GEMM_2_T);
+
+                for (int i = 0; i < scores.rows; ++i) {
+                    const float* rowScores = scores.ptr<float>(i);
+                    int j = (a == b) ? i + 1 : 0;
+                    for (; j < scores.cols; ++j) {
+                        if (rowScores[j] >= threshold) {
+                            localPairs.push_back({ order[a * tileRows + i], order[b * tileRows + j], rowScores[j] });
+                        }
+                    }
+                }
+            }
+        }
+
+        skippedTiles += skipped;
+        std::lock_guard<std::mutex> lock(pairsMutex);
+        pairs.insert(pairs.end(), localPairs.begin(), localPairs.end());
+    });
+
+    if (stats) {
+        stats->tilePairs = static_cast<long long>(numTiles) * (numTiles + 1) / 2;
+        stats->tilePairsPruned = skippedTiles.load();
+    }
+    TRACE_COUNTER("tiles_pruned", skippedTiles.load());
+    TRACE_COUNTER("duplicate_pairs", pairs.size());
+    return pairs;
+}
+
+// Group rows connected by duplicate pairs; only groups with more than one member are returned
+std::vector<std::vector<int>> clusterDuplicates(const std::vector<DuplicatePair>& pairs, int count) {
+    DisjointSet sets(count);
+    for (const auto& pair : pairs) {
+        sets.unite(pair.first, pair.second);
+    }
+
+    std::map<int, std::vector<int>> groups;
+    for (const auto& pair : pairs) {
+        groups[sets.find(pair.first)];
+    }
+    for (int i = 0; i < count; ++i) {
+        auto group = groups.find(sets.find(i));
+        if (group != groups.end()) {
+            group->second.push_back(i);
+        }
+    }
+
+    std::vector<std::vector<int>> clusters;
+    for (auto& group : groups) {
+        clusters.push_back(std::move(group.second));
+    }
+    return clusters;
+}
+
+void dedupAndSaveFeatures(FeatureDatabase db, std::string featureType, std::string dataset, std::string path, double threshold, bool drop, const std::vector<std::string>& relatedTypes, int tileRows) {
+    std::cout << "Loading features...\n";
+    FeatureMatrix store = packFeatures(db.loadFeatures(featureType, dataset, path));
+    if (store.data.empty()) {
+        std::cerr << "No features loaded from the database." << std::endl;
+        return;
+    }
+
+    std::cout << "Joining " << store.data.rows << " images at threshold " << threshold << std::endl;
+    JoinStats stats;
+    std::vector<DuplicatePair> pairs = findDuplicatePairs(store, threshold, tileRows, &stats);
+    std::cout << "Pruned " << stats.tilePairsPruned << " of " << stats.tilePairs << " tile pairs ("
+        << (stats.tilePairs > 0 ? 100.0 * stats.tilePairsPruned / stats.tilePairs : 0.0) << "%)" << std::endl;
+    std::vector<std::vector<int>> clusters = clusterDuplicates(pairs, store.data.rows);
+
+    // The first member of each cluster (lowest row) is kept as its representative
+    std::unordered_set<std::string> duplicates;
+    for (const auto& cluster : clusters) {
+        std::cout << "Duplicate group:";
+        for (int index : cluster) {
+            std::cout << " " << store.names[index];
+        }
+        std::cout << std::endl;
+
+        for (size_t i = 1; i < cluster.size(); ++i) {
+            duplicates.insert(store.names[cluster[i]]);
+        }
+    }
+    std::cout << clusters.size() << " duplicate groups, " << duplicates.size() << " redundant images" << std::endl;
+
+    if (!drop || duplicates.empty()) {
+        return;
+    }
+
+    // Collapse every per-image store of the dataset onto the cluster representatives: the related feature
+    // stores, any other store found next to them (signatures, histograms), the thumbnails and the row stores
+    std::set<std::string> types(relatedTypes.begin(), relatedTypes.end());
+    types.insert(featureType);
+    std::string suffix = "_" + dataset + ".xml";
+    for (const auto& entry : std::filesystem::directory_iterator(path.empty() ? "." : path)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0
+            && name.find("_codebook_") == std::string::npos) {
+            types.insert(name.substr(0, name.size() - suffix.size()));
+        }
+    }
+
+    for (const auto& type : types) {
+        std::string filename = db.featureFilename(type, dataset, path);
+        if (!std::filesystem::exists(filename)) {
+            continue;
+        }
+
+        std::vector<std::pair<std::string, Mat>> features = db.loadFeatures(type, dataset, path);
+        size_t before = features.size();
+        features.erase(std::remove_if(features.begin(), features.end(), [&](const std::pair<std::string, Mat>& feature) {
+            return duplicates.count(feature.first) > 0;
+            }), features.end());
+
+        if (features.size() != before) {
+            db.saveFeatures(features, type, dataset, path);
+            std::cout << "Dropped " << before - features.size() << " duplicates from " << filename << std::endl;
+
+            // Derived files of the rewritten store would otherwise keep serving the dropped images
+            if (std::filesystem::exists(db.rowStoreFilename(type, dataset, path))) {
+                db.saveRowStore(type, dataset, path);
+            }
+            std::error_code error;
+            std::filesystem::remove(db.chunkIndexFilename(type, dataset, path), error);
+        }
+    }
+
+    std::string thumbnailFile = db.thumbnailFilename(dataset, path);
+    if (std::filesystem::exists(thumbnailFile)) {
+        // The kept thumbnails are written back at the size they were cached at
+        int thumbnailSize = db.thumbnailCacheSize(dataset, path);
+        std::unordered_map<std::string, std::vector<uchar>> thumbnails = db.loadThumbnails(dataset, path, thumbnailSize);
+        std::vector<std::pair<std::string, std::vector<uchar>>> kept;
+        for (auto& thumbnail : thumbnails) {
+            if (!duplicates.count(thumbnail.first)) {
+                kept.emplace_back(thumbnail.first, std::move(thumbnail.second));
+            }
+        }
+        if (kept.size() != thumbnails.size()) {
+            db.saveThumbnails(kept, thumbnailSize, dataset, path);
+            std::cout << "Dropped " << thumbnails.size() - kept.size() << " duplicates from " << thumbnailFile << std::endl;
+        }
+    }
+}
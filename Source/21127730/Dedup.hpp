@@ -0,0 +1,23 @@
+#pragma once
+#include "Database.hpp"
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+#include <set>
+#include <vector>
+
+// Pair of store rows whose cosine similarity reaches the duplicate threshold
+struct DuplicatePair {
+    int first;
+    int second;
+    double similarity;
+};
+
+// How much of the tile-pair grid the projection bound let the join skip
+struct JoinStats {
+    long long tilePairs = 0;
+    long long tilePairsPruned = 0;
+};
+
+std::vector<DuplicatePair> findDuplicatePairs(const FeatureMatrix& store, double threshold, int tileRows = 256, JoinStats* stats = nullptr);
+std::vector<std::vector<int>> clusterDuplicates(const std::vector<DuplicatePair>& pairs, int count);
+void dedupAndSaveFeatures(FeatureDatabase db, std::string featureType, std::string dataset, std::string path, double threshold, bool drop, const std::vector<std::string>& relatedTypes, int tileRows = 256);
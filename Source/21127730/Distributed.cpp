@@ -0,0 +1,476 @@
+// Socket headers must come before windows.h (pulled in through Database.hpp)
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET SocketHandle;
+#define closeSocket closesocket
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+typedef int SocketHandle;
+#define INVALID_SOCKET (-1)
+#define closeSocket close
+#endif
+
+// A peer that went away must fail the send, not raise SIGPIPE and kill the process
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+#include "Distributed.hpp"
+#include "Retrieval.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Wire format, native byte order (all processes run on the same machine):
+//   request:  "VIRQ" | numResults | rows | cols | CV_32F data
+//   response: "VIRR" | count | { nameLength | name | score (double) } * count
+
+namespace {
+
+struct SocketSystem {
+    SocketSystem() {
+#ifdef _WIN32
+        WSADATA data;
+        WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+    }
+    ~SocketSystem() {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+};
+
+void setReceiveTimeout(SocketHandle socket, int timeoutMs) {
+#ifdef _WIN32
+    DWORD timeout = timeoutMs;
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+#else
+    timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+}
+
+bool sendAll(SocketHandle socket, const std::vector<char>& buffer) {
+    size_t sent = 0;
+    while (sent < buffer.size()) {
+        int result = send(socket, buffer.data() + sent, static_cast<int>(buffer.size() - sent), SEND_FLAGS);
+        if (result <= 0) {
+            return false;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+int lastSocketError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+void setBlocking(SocketHandle socket, bool blocking) {
+#ifdef _WIN32
+    u_long mode = blocking ? 0 : 1;
+    ioctlsocket(socket, FIONBIO, &mode);
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    fcntl(socket, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+#endif
+}
+
+// Non-blocking connect bounded by select, so a dead or unreachable worker costs at most timeoutMs
+bool connectWithTimeout(SocketHandle socket, const sockaddr_in& address, int timeoutMs) {
+    setBlocking(socket, false);
+    int result = connect(socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+    if (result != 0) {
+#ifdef _WIN32
+        bool inProgress = WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        bool inProgress = errno == EINPROGRESS;
+#endif
+        if (!inProgress) {
+            return false;
+        }
+
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(socket, &writable);
+        timeval timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+        if (select(static_cast<int>(socket + 1), nullptr, &writable, nullptr, &timeout) <= 0) {
+            return false;
+        }
+
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) != 0 || error != 0) {
+            return false;
+        }
+    }
+    setBlocking(socket, true);
+    return true;
+}
+
+template <typename T>
+void append(std::vector<char>& buffer, const T& value) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+bool take(const std::vector<char>& buffer, size_t& offset, T& value) {
+    if (offset + sizeof(T) > buffer.size()) {
+        return false;
+    }
+    std::memcpy(&value, buffer.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+std::vector<char> encodeResponse(const std::vector<std::pair<std::string, double>>& results) {
+    std::vector<char> buffer;
+    buffer.insert(buffer.end(), { 'V', 'I', 'R', 'R' });
+    append(buffer, static_cast<uint32_t>(results.size()));
+    for (const auto& result : results) {
+        append(buffer, static_cast<uint32_t>(result.first.size()));
+        buffer.insert(buffer.end(), result.first.begin(), result.first.end());
+        append(buffer, result.second);
+    }
+    return buffer;
+}
+
+bool decodeResponse(const std::vector<char>& buffer, std::vector<std::pair<std::string, double>>& results) {
+    size_t offset = 4;
+    uint32_t count = 0;
+    if (buffer.size() < 4 || std::string(buffer.data(), 4) != "VIRR" || !take(buffer, offset, count)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t nameLength = 0;
+        double score = 0.0;
+        if (!take(buffer, offset, nameLength) || offset + nameLength > buffer.size()) {
+            return false;
+        }
+        std::string name(buffer.data() + offset, nameLength);
+        offset += nameLength;
+        if (!take(buffer, offset, score)) {
+            return false;
+        }
+        results.emplace_back(name, score);
+    }
+    return true;
+}
+
+sockaddr_in makeAddress(const std::string& host, int port) {
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<unsigned short>(port));
+    inet_pton(AF_INET, host.c_str(), &address.sin_addr);
+    return address;
+}
+
+// Rows of the worker's range as views into one matrix, in the form rankBySimilarity scores
+struct Partition {
+    FeatureMatrix matrix;
+    std::vector<std::pair<std::string, Mat>> rows;
+    MemoryHandle memory;
+};
+
+// Clients being served right now; the accept loop waits for a free slot before taking the next one
+struct ClientSlots {
+    std::mutex mutex;
+    std::condition_variable released;
+    int active = 0;
+};
+
+// Set by SIGINT/SIGTERM; the accept loop polls it between connections
+volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int) {
+    stopRequested = 1;
+}
+
+void serveClient(SocketHandle client, std::shared_ptr<const Partition> partition, std::shared_ptr<ClientSlots> slots) {
+    setReceiveTimeout(client, 5000);
+
+    // Header first, then exactly rows * cols floats
+    std::vector<char> request(20);
+    size_t received = 0;
+    while (received < request.size()) {
+        int result = recv(client, request.data() + received, static_cast<int>(request.size() - received), 0);
+        if (result <= 0) {
+            break;
+        }
+        received += result;
+
+        if (received == 20 && request.size() == 20) {
+            size_t offset = 4;
+            int32_t numResults = 0, rows = 0, cols = 0;
+            take(request, offset, numResults);
+            take(request, offset, rows);
+            take(request, offset, cols);
+            if (std::string(request.data(), 4) != "VIRQ" || rows < 0 || cols < 0 || static_cast<int64_t>(rows) * cols > (1 << 24)) {
+                break;
+            }
+            request.resize(20 + static_cast<size_t>(rows) * cols * sizeof(float));
+        }
+    }
+
+    if (received == request.size() && request.size() >= 20) {
+        TRACE_SCOPE("worker_request");
+        size_t offset = 4;
+        int32_t numResults = 0, rows = 0, cols = 0;
+        take(request, offset, numResults);
+        take(request, offset, rows);
+        take(request, offset, cols);
+        Mat queryFeature = Mat(rows, cols, CV_32F, request.data() + 20).clone();
+
+        // Same scoring path as a single-process retrieve, restricted to this partition
+        sendAll(client, encodeResponse(rankBySimilarity(queryFeature, partition->rows, numResults)));
+    }
+    else {
+        std::cerr << "Dropped malformed or incomplete request" << std::endl;
+    }
+    closeSocket(client);
+
+    std::lock_guard<std::mutex> lock(slots->mutex);
+    --slots->active;
+    slots->released.notify_all();
+}
+
+}
+
+int runRetrievalWorker(FeatureDatabase db, int port, int begin, int end, int maxClients, const std::string& featureType, const std::string& dataset, std::string path) {
+    SocketSystem sockets;
+
+    // Only the worker's own rows are read, straight from the row store
+    if (!db.ensureRowStore(featureType, dataset, path) && !db.saveRowStore(featureType, dataset, path)) {
+        std::cerr << "No row store for " << featureType << std::endl;
+        return 1;
+    }
+    RowStoreReader reader(db.rowStoreFilename(featureType, dataset, path));
+    if (!reader.isOpen()) {
+        return 1;
+    }
+
+    int total = static_cast<int>(reader.rows());
+    end = (end < 0 || end > total) ? total : end;
+    begin = std::min(std::max(begin, 0), end);
+
+    auto partition = std::make_shared<Partition>();
+    std::vector<std::string> names = reader.names();
+    partition->matrix.names.assign(names.begin() + std::min<size_t>(begin, names.size()), names.begin() + std::min<size_t>(end, names.size()));
+    partition->matrix.data.create(end - begin, reader.dims(), CV_32F);
+    reader.seek(begin);
+    size_t loaded = end > begin ? reader.read(partition->matrix.data.ptr<float>(0), end - begin) : 0;
+    if (loaded != static_cast<size_t>(end - begin) || partition->matrix.names.size() != loaded) {
+        std::cerr << "Failed to read images [" << begin << ", " << end << ") from the row store" << std::endl;
+        return 1;
+    }
+    for (size_t i = 0; i < loaded; ++i) {
+        partition->rows.emplace_back(partition->matrix.names[i], partition->matrix.data.row(static_cast<int>(i)));
+    }
+    partition->memory = trackFeatureMatrix("worker/" + featureType, partition->matrix);
+    std::cout << "Worker owns images [" << begin << ", " << end << ") of " << total << std::endl;
+
+    SocketHandle listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+    sockaddr_in address = makeAddress("127.0.0.1", port);
+    if (listener == INVALID_SOCKET || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        std::cerr << "Failed to listen on port " << port << std::endl;
+        return 1;
+    }
+    std::cout << "Worker listening on 127.0.0.1:" << port << std::endl;
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    // Each client is served on its own thread, so a slow sender cannot hold up the others; at most maxClients
+    // run at once and further connections wait in the listen backlog
+    auto slots = std::make_shared<ClientSlots>();
+    maxClients = std::max(1, maxClients);
+    int backoffMs = 0;
+    while (!stopRequested) {
+        {
+            std::unique_lock<std::mutex> lock(slots->mutex);
+            if (!slots->released.wait_for(lock, std::chrono::milliseconds(200), [&]() { return slots->active < maxClients; })) {
+                continue;
+            }
+        }
+
+        // Poll instead of blocking in accept, so a stop request is noticed even when no client arrives
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listener, &readable);
+        timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 200000;
+        int ready = select(static_cast<int>(listener + 1), &readable, nullptr, nullptr, &timeout);
+        if (ready == 0) {
+            continue;
+        }
+
+        SocketHandle client = ready > 0 ? accept(listener, nullptr, nullptr) : INVALID_SOCKET;
+        if (client == INVALID_SOCKET) {
+            if (stopRequested) {
+                break;
+            }
+            backoffMs = std::min(std::max(2 * backoffMs, 10), 1000);
+            std::cerr << "Accept failed (error " << lastSocketError() << "), retrying in " << backoffMs << " ms" << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(backoffMs));
+            continue;
+        }
+        backoffMs = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(slots->mutex);
+            ++slots->active;
+        }
+        std::thread(serveClient, client, std::shared_ptr<const Partition>(partition), slots).detach();
+    }
+    closeSocket(listener);
+
+    // Requests already accepted are answered before the sockets are torn down
+    std::unique_lock<std::mutex> lock(slots->mutex);
+    slots->released.wait(lock, [&]() { return slots->active == 0; });
+    std::cout << "Worker on port " << port << " stopped" << std::endl;
+    return 0;
+}
+
+ScatterGatherResult scatterGatherSearch(const Mat& queryFeature, const std::vector<std::string>& workers, int numResults, int timeoutMs) {
+    TRACE_SCOPE("scatter_gather");
+    SocketSystem sockets;
+    ScatterGatherResult answer;
+    answer.workersTotal = static_cast<int>(workers.size());
+
+    Mat query;
+    queryFeature.reshape(1, 1).convertTo(query, CV_32F);
+
+    std::vector<char> request;
+    request.insert(request.end(), { 'V', 'I', 'R', 'Q' });
+    append(request, static_cast<int32_t>(numResults));
+    append(request, static_cast<int32_t>(query.rows));
+    append(request, static_cast<int32_t>(query.cols));
+    request.insert(request.end(), reinterpret_cast<const char*>(query.ptr()), reinterpret_cast<const char*>(query.ptr()) + query.total() * sizeof(float));
+
+    // Connecting counts against the same deadline as the replies
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    // Broadcast the query feature once to every worker
+    std::vector<SocketHandle> connections;
+    std::vector<std::string> names;
+    for (const auto& worker : workers) {
+        size_t colon = worker.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Invalid worker address (expected host:port): " << worker << std::endl;
+            continue;
+        }
+
+        SocketHandle connection = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = makeAddress(worker.substr(0, colon), stoi(worker.substr(colon + 1)));
+        int remainingMs = static_cast<int>(std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count()));
+        if (connection == INVALID_SOCKET || !connectWithTimeout(connection, address, remainingMs) || !sendAll(connection, request)) {
+            std::cerr << "Worker unavailable: " << worker << std::endl;
+            if (connection != INVALID_SOCKET) {
+                closeSocket(connection);
+            }
+            continue;
+        }
+        connections.push_back(connection);
+        names.push_back(worker);
+    }
+
+    // Gather replies until every worker answered or the deadline passed
+    std::vector<std::vector<char>> buffers(connections.size());
+    std::vector<bool> open(connections.size(), true);
+    size_t pending = connections.size();
+    char chunk[65536];
+
+    while (pending > 0) {
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0) {
+            break;
+        }
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        SocketHandle highest = 0;
+        for (size_t i = 0; i < connections.size(); ++i) {
+            if (open[i]) {
+                FD_SET(connections[i], &readable);
+                highest = std::max(highest, connections[i]);
+            }
+        }
+
+        timeval timeout;
+        timeout.tv_sec = static_cast<long>(remaining / 1000000);
+        timeout.tv_usec = static_cast<long>(remaining % 1000000);
+        if (select(static_cast<int>(highest + 1), &readable, nullptr, nullptr, &timeout) <= 0) {
+            continue;
+        }
+
+        for (size_t i = 0; i < connections.size(); ++i) {
+            if (!open[i] || !FD_ISSET(connections[i], &readable)) {
+                continue;
+            }
+
+            int result = recv(connections[i], chunk, sizeof(chunk), 0);
+            if (result > 0) {
+                buffers[i].insert(buffers[i].end(), chunk, chunk + result);
+                continue;
+            }
+
+            // The worker closes the connection once its reply is complete
+            open[i] = false;
+            --pending;
+            std::vector<std::pair<std::string, double>> partial;
+            if (result == 0 && decodeResponse(buffers[i], partial)) {
+                answer.results.insert(answer.results.end(), partial.begin(), partial.end());
+                answer.workersAnswered++;
+            }
+            else {
+                std::cerr << "Invalid reply from worker: " << names[i] << std::endl;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < connections.size(); ++i) {
+        if (open[i]) {
+            std::cerr << "Worker timed out: " << names[i] << std::endl;
+        }
+        closeSocket(connections[i]);
+    }
+
+    // Merge the partial top-n lists into the global one
+    std::sort(answer.results.begin(), answer.results.end(), [](const std::pair<std::string, double>& a, const std::pair<std::string, double>& b) {
+        return a.second > b.second;
+        });
+    if (static_cast<int>(answer.results.size()) > numResults) {
+        answer.results.resize(numResults);
+    }
+    return answer;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "Database.hpp"
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+// Worker process: owns rows [begin, end) of the store (end < 0 means to the end), reads only those rows
+// from the row store, and answers scoring requests on 127.0.0.1:port, up to maxClients at once, until it
+// receives SIGINT or SIGTERM
+int runRetrievalWorker(FeatureDatabase db, int port, int begin, int end, int maxClients, const std::string& featureType, const std::string& dataset, std::string path);
+
+// Partial answer merged from the workers that replied before the timeout
+struct ScatterGatherResult {
+    std::vector<std::pair<std::string, double>> results;
+    int workersAnswered = 0;
+    int workersTotal = 0;
+};
+
+// Coordinator: sends the query feature to every "host:port" worker and merges their top-n lists
+ScatterGatherResult scatterGatherSearch(const Mat& queryFeature, const std::vector<std::string>& workers, int numResults, int timeoutMs);
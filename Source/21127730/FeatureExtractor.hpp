@@ -17,6 +17,18 @@ public:
 	Mat extractFeature(const Mat& image) override;
 };
 
+// Cheap reduced-bin color histogram used as the first cascade stage
+class ColorSignatureExtractor : public FeatureExtractorInterface {
+public:
+    Mat extractFeature(const Mat& image) override;
+};
+
+// 64-bit DCT perceptual hash packed into a 1x8 CV_8U row; near-identical images differ in few bits
+class PerceptualHashExtractor : public FeatureExtractorInterface {
+public:
+    Mat extractFeature(const Mat& image) override;
+};
+
 class ColorCorrelogramExtractor : public FeatureExtractorInterface {
 public:
     Mat extractFeature(const Mat& image) override;
@@ -28,11 +40,15 @@ private:
 class SIFTFeatureExtractor : public FeatureExtractorInterface {
 public:
     Mat extractFeature(const Mat& image) override;
+private:
+    Ptr<SIFT> sift;
 };
 
 class ORBFeatureExtractor : public FeatureExtractorInterface {
 public:
     Mat extractFeature(const Mat& image) override;
+private:
+    Ptr<ORB> orb;
 };
 
 // Factory class to create feature objects
@@ -42,6 +58,12 @@ public:
         if (featureType == "histogram") {
             return std::make_unique<ColorHistogramExtractor>();
         }
+        else if (featureType == "signature") {
+            return std::make_unique<ColorSignatureExtractor>();
+        }
+        else if (featureType == "phash") {
+            return std::make_unique<PerceptualHashExtractor>();
+        }
         else if (featureType == "correlogram") {
             return std::make_unique<ColorCorrelogramExtractor>();
         }
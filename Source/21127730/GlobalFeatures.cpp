@@ -23,6 +23,74 @@ Mat ColorHistogramExtractor::extractFeature(const Mat& image) {
     return hist.reshape(1, 1); // Flatten histogram
 }
 
+//Color Signature: 8 bins per channel on a downscaled copy, 24 values in total
+Mat ColorSignatureExtractor::extractFeature(const Mat& image) {
+    if (image.empty()) {
+        throw std::invalid_argument("Input image is empty");
+    }
+
+    // Binning this coarse does not need full resolution
+    Mat small = image;
+    int maxSide = std::max(image.cols, image.rows);
+    if (maxSide > 128) {
+        double scale = 128.0 / maxSide;
+        cv::resize(image, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    }
+
+    std::vector<Mat> channels;
+    cv::split(small, channels);
+
+    int histSize = 8;
+    float range[] = { 0, 256 };
+    const float* histRange = { range };
+
+    Mat hist;
+    std::vector<Mat> histograms;
+    for (int i = 0; i < 3; ++i) {
+        Mat channel_hist;
+        cv::calcHist(&channels[i], 1, 0, Mat(), channel_hist, 1, &histSize, &histRange);
+        histograms.push_back(channel_hist);
+    }
+
+    cv::hconcat(histograms, hist);
+    hist /= cv::sum(hist)[0];
+    return hist.reshape(1, 1);
+}
+
+//Perceptual Hash: signs of the 8x8 lowest DCT frequencies of a 32x32 gray copy against their median
+Mat PerceptualHashExtractor::extractFeature(const Mat& image) {
+    if (image.empty()) {
+        throw std::invalid_argument("Input image is empty");
+    }
+
+    Mat gray = image;
+    if (image.channels() == 3) {
+        cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+    }
+
+    Mat small;
+    cv::resize(gray, small, cv::Size(32, 32), 0, 0, cv::INTER_AREA);
+    small.convertTo(small, CV_32F);
+
+    Mat coefficients;
+    cv::dct(small, coefficients);
+    Mat block = coefficients(cv::Rect(0, 0, 8, 8)).clone();
+
+    // The DC term only carries overall brightness, so it is left out of the median
+    std::vector<float> values(block.ptr<float>(0) + 1, block.ptr<float>(0) + 64);
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    float median = values[values.size() / 2];
+
+    Mat hash = Mat::zeros(1, 8, CV_8U);
+    const float* bits = block.ptr<float>(0);
+    for (int i = 0; i < 64; ++i) {
+        if (bits[i] > median) {
+            hash.at<uchar>(0, i / 8) |= static_cast<uchar>(1 << (7 - i % 8));
+        }
+    }
+    return hash;
+}
+
 //Color Correlogram
 Mat ColorCorrelogramExtractor::extractFeature(const Mat& image) {
     if (image.empty()) {
@@ -0,0 +1,340 @@
+#include "HashIndex.hpp"
+#include <bitset>
+#include <filesystem>
+
+uint64_t packHash(const Mat& hash) {
+    uint64_t value = 0;
+    if (hash.total() * hash.elemSize() != 8 || !hash.isContinuous()) {
+        return value;
+    }
+    const uchar* bytes = hash.ptr<uchar>(0);
+    for (int i = 0; i < 8; ++i) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+int hammingDistance(uint64_t a, uint64_t b) {
+    return static_cast<int>(std::bitset<64>(a ^ b).count());
+}
+
+// At least two pieces keep every piece within 32 bits, so it fits a uint32_t key and its bit flips
+MultiIndexHash::MultiIndexHash(int substrings) : substrings_(std::min(std::max(substrings, 2), 8)) {
+    pieceBits_ = 64 / substrings_;
+    tables_.resize(substrings_);
+}
+
+// The last piece takes the bits left over when 64 does not divide evenly
+uint32_t MultiIndexHash::piece(uint64_t hash, int index) const {
+    int shift = index * pieceBits_;
+    int bits = index == substrings_ - 1 ? 64 - shift : pieceBits_;
+    uint64_t mask = bits >= 64 ? ~0ULL : ((1ULL << bits) - 1);
+    return static_cast<uint32_t>((hash >> shift) & mask);
+}
+
+void MultiIndexHash::build(const std::vector<std::pair<std::string, Mat>>& hashes) {
+    names_.reserve(names_.size() + hashes.size());
+    hashes_.reserve(hashes_.size() + hashes.size());
+    for (const auto& hash : hashes) {
+        if (hash.second.total() * hash.second.elemSize() != 8) {
+            std::cerr << "Skipping feature with mismatched size: " << hash.first << std::endl;
+            continue;
+        }
+        add(hash.first, packHash(hash.second));
+    }
+    index();
+}
+
+void MultiIndexHash::add(const std::string& name, uint64_t hash) {
+    names_.push_back(name);
+    hashes_.push_back(hash);
+}
+
+// Sorting (key, id) pairs groups each bucket's ids together, in id order
+void MultiIndexHash::index() {
+    TRACE_SCOPE("hash_build");
+    std::vector<std::pair<uint32_t, uint32_t>> entries(hashes_.size());
+    for (int t = 0; t < substrings_; ++t) {
+        for (size_t id = 0; id < hashes_.size(); ++id) {
+            entries[id] = { piece(hashes_[id], t), static_cast<uint32_t>(id) };
+        }
+        std::sort(entries.begin(), entries.end());
+
+        Table& table = tables_[t];
+        table.keys.clear();
+        table.starts.clear();
+        table.ids.resize(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (i == 0 || entries[i].first != entries[i - 1].first) {
+                table.keys.push_back(entries[i].first);
+                table.starts.push_back(static_cast<uint32_t>(i));
+            }
+            table.ids[i] = entries[i].second;
+        }
+        table.starts.push_back(static_cast<uint32_t>(entries.size()));
+    }
+}
+
+// Visits every key within flipsLeft bit flips of `key`, flipping only bits at or above `bit` so each key is seen once
+void MultiIndexHash::probe(int table, uint32_t key, int bit, int flipsLeft, std::vector<uint32_t>& candidates) const {
+    const Table& buckets = tables_[table];
+    auto found = std::lower_bound(buckets.keys.begin(), buckets.keys.end(), key);
+    if (found != buckets.keys.end() && *found == key) {
+        size_t bucket = found - buckets.keys.begin();
+        candidates.insert(candidates.end(), buckets.ids.begin() + buckets.starts[bucket], buckets.ids.begin() + buckets.starts[bucket + 1]);
+    }
+    if (flipsLeft == 0) {
+        return;
+    }
+
+    int bits = table == substrings_ - 1 ? 64 - table * pieceBits_ : pieceBits_;
+    for (int b = bit; b < bits; ++b) {
+        probe(table, key ^ (1u << b), b + 1, flipsLeft - 1, candidates);
+    }
+}
+
+std::vector<std::pair<std::string, int>> MultiIndexHash::search(uint64_t query, int radius) const {
+    std::vector<std::pair<std::string, int>> results;
+    if (hashes_.empty() || radius < 0) {
+        return results;
+    }
+
+    std::vector<uint32_t> candidates;
+    int pieceRadius = radius / substrings_;
+    for (int table = 0; table < substrings_; ++table) {
+        probe(table, piece(query, table), 0, pieceRadius, candidates);
+    }
+
+    // A hash close on several pieces turns up once per piece
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    TRACE_COUNTER("hash_candidates", candidates.size());
+
+    std::vector<std::pair<int, uint32_t>> hits;
+    for (uint32_t id : candidates) {
+        int distance = hammingDistance(query, hashes_[id]);
+        if (distance <= radius) {
+            hits.push_back({ distance, id });
+        }
+    }
+    std::sort(hits.begin(), hits.end());
+
+    results.reserve(hits.size());
+    for (const auto& hit : hits) {
+        results.push_back({ names_[hit.second], hit.first });
+    }
+    return results;
+}
+
+// Written to a temporary file and renamed over the index, so an interrupted save never leaves a partial .mih
+bool MultiIndexHash::save(const std::string& filename, const SourceStamp& source) const {
+    std::string temporary = filename + ".tmp";
+    std::ofstream file(temporary, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file for writing: " << temporary << std::endl;
+        return false;
+    }
+
+    uint32_t substrings = static_cast<uint32_t>(substrings_);
+    uint64_t count = hashes_.size();
+    file.write("VIRH", 4);
+    file.write(reinterpret_cast<const char*>(&source.size), sizeof(source.size));
+    file.write(reinterpret_cast<const char*>(&source.modified), sizeof(source.modified));
+    file.write(reinterpret_cast<const char*>(&substrings), sizeof(substrings));
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char*>(hashes_.data()), count * sizeof(uint64_t));
+
+    uint64_t offset = 0;
+    for (const auto& name : names_) {
+        file.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        offset += name.size();
+    }
+    file.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    for (const auto& name : names_) {
+        file.write(name.data(), name.size());
+    }
+
+    for (const auto& table : tables_) {
+        uint64_t keys = table.keys.size();
+        file.write(reinterpret_cast<const char*>(&keys), sizeof(keys));
+        file.write(reinterpret_cast<const char*>(table.keys.data()), keys * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(table.starts.data()), table.starts.size() * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(table.ids.data()), table.ids.size() * sizeof(uint32_t));
+    }
+
+    bool ok = static_cast<bool>(file);
+    file.close();
+    std::error_code error;
+    if (ok) {
+        std::filesystem::rename(temporary, filename, error);
+    }
+    if (!ok || error) {
+        std::cerr << "Failed to write hash index: " << filename << std::endl;
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+bool MultiIndexHash::load(const std::string& filename, const SourceStamp& source) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::error_code error;
+    uint64_t fileSize = std::filesystem::file_size(filename, error);
+    if (error) {
+        return false;
+    }
+
+    char magic[4];
+    SourceStamp stamp;
+    uint32_t substrings = 0;
+    uint64_t count = 0;
+    file.read(magic, 4);
+    file.read(reinterpret_cast<char*>(&stamp.size), sizeof(stamp.size));
+    file.read(reinterpret_cast<char*>(&stamp.modified), sizeof(stamp.modified));
+    file.read(reinterpret_cast<char*>(&substrings), sizeof(substrings));
+    file.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!file || std::string(magic, 4) != "VIRH" || stamp != source || static_cast<int>(substrings) != substrings_) {
+        return false;
+    }
+
+    // Every size in the file is checked against the bytes left before anything is allocated from it
+    uint64_t remaining = fileSize - static_cast<uint64_t>(file.tellg());
+    if (count > remaining / (2 * sizeof(uint64_t)) || count >= UINT32_MAX) {
+        std::cerr << "Truncated hash index: " << filename << std::endl;
+        return false;
+    }
+    std::vector<uint64_t> hashes(static_cast<size_t>(count));
+    std::vector<uint64_t> offsets(static_cast<size_t>(count + 1));
+    file.read(reinterpret_cast<char*>(hashes.data()), hashes.size() * sizeof(uint64_t));
+    file.read(reinterpret_cast<char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    if (!file) {
+        std::cerr << "Truncated hash index: " << filename << std::endl;
+        return false;
+    }
+    remaining = fileSize - static_cast<uint64_t>(file.tellg());
+    for (uint64_t i = 0; i < count; ++i) {
+        if (offsets[i] > offsets[i + 1]) {
+            std::cerr << "Invalid name table in the hash index: " << filename << std::endl;
+            return false;
+        }
+    }
+    if (offsets.back() > remaining) {
+        std::cerr << "Truncated hash index: " << filename << std::endl;
+        return false;
+    }
+    std::string bytes(static_cast<size_t>(offsets.back()), '\0');
+    file.read(&bytes[0], bytes.size());
+
+    std::vector<Table> tables(substrings_);
+    for (auto& table : tables) {
+        uint64_t keys = 0;
+        file.read(reinterpret_cast<char*>(&keys), sizeof(keys));
+        if (!file || keys > count) {
+            return false;
+        }
+        table.keys.resize(static_cast<size_t>(keys));
+        table.starts.resize(static_cast<size_t>(keys + 1));
+        table.ids.resize(static_cast<size_t>(count));
+        file.read(reinterpret_cast<char*>(table.keys.data()), table.keys.size() * sizeof(uint32_t));
+        file.read(reinterpret_cast<char*>(table.starts.data()), table.starts.size() * sizeof(uint32_t));
+        file.read(reinterpret_cast<char*>(table.ids.data()), table.ids.size() * sizeof(uint32_t));
+        if (!file) {
+            break;
+        }
+
+        // Buckets index into ids and ids into hashes, so both have to stay in range for search()
+        bool valid = table.starts.front() == 0 && table.starts.back() == count;
+        for (size_t i = 1; valid && i < table.starts.size(); ++i) {
+            valid = table.starts[i - 1] <= table.starts[i];
+        }
+        for (size_t i = 0; valid && i < table.ids.size(); ++i) {
+            valid = table.ids[i] < count;
+        }
+        if (!valid) {
+            std::cerr << "Invalid table in the hash index: " << filename << std::endl;
+            return false;
+        }
+    }
+    if (!file) {
+        std::cerr << "Truncated hash index: " << filename << std::endl;
+        return false;
+    }
+
+    names_.clear();
+    names_.reserve(static_cast<size_t>(count));
+    for (uint64_t i = 0; i < count; ++i) {
+        names_.push_back(bytes.substr(static_cast<size_t>(offsets[i]), static_cast<size_t>(offsets[i + 1] - offsets[i])));
+    }
+    hashes_ = std::move(hashes);
+    tables_ = std::move(tables);
+    return true;
+}
+
+size_t MultiIndexHash::memoryBytes() const {
+    size_t bytes = hashes_.capacity() * sizeof(uint64_t) + names_.capacity() * sizeof(std::string);
+    for (const auto& name : names_) {
+        if (name.capacity() >= sizeof(std::string)) {
+            bytes += name.capacity() + 1;
+        }
+    }
+    for (const auto& table : tables_) {
+        bytes += (table.keys.capacity() + table.starts.capacity() + table.ids.capacity()) * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+bool loadHashIndex(MultiIndexHash& index, FeatureDatabase& db, const std::string& dataset, std::string path) {
+    std::string filename = db.hashIndexFilename(dataset, path);
+    SourceStamp source = sourceStamp(db.featureFilename("phash", dataset, path));
+    {
+        TRACE_SCOPE("hash_load");
+        if (index.load(filename, source)) {
+            return index.size() > 0;
+        }
+    }
+
+    // The hashes are streamed in, so building never holds the parsed store
+    index = MultiIndexHash();
+    bool loaded = db.forEachFeatureChunk("phash", dataset, path, size_t(16) << 20, [&](std::vector<std::pair<std::string, Mat>>& chunk) {
+        for (const auto& hash : chunk) {
+            if (hash.second.total() * hash.second.elemSize() != 8) {
+                std::cerr << "Skipping feature with mismatched size: " << hash.first << std::endl;
+                continue;
+            }
+            index.add(hash.first, packHash(hash.second));
+        }
+    });
+    index.index();
+    if (!loaded || index.size() == 0) {
+        return false;
+    }
+    index.save(filename, source);
+    return true;
+}
+
+std::vector<std::pair<std::string, int>> findNearDuplicates(const Mat& image, const MultiIndexHash& index, int radius, int numResults) {
+    TRACE_SCOPE("hash_lookup");
+    std::vector<std::pair<std::string, int>> hits;
+    Mat hash = extractFeaturesFromImage(image, "phash");
+    if (hash.empty()) {
+        return hits;
+    }
+
+    hits = index.search(packHash(hash), radius);
+    if (static_cast<int>(hits.size()) > numResults) {
+        hits.resize(std::max(numResults, 0));
+    }
+    return hits;
+}
+
+std::vector<std::pair<std::string, int>> findNearDuplicates(const Mat& image, FeatureDatabase db, const std::string& dataset, std::string path, int radius, int numResults) {
+    MultiIndexHash index;
+    if (!loadHashIndex(index, db, dataset, path)) {
+        return {};
+    }
+    MemoryHandle memory("index/phash_" + dataset, index.memoryBytes(), index.size());
+    return findNearDuplicates(image, index, radius, numResults);
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "Database.hpp"
+#include "Processing.hpp"
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+uint64_t packHash(const Mat& hash);
+int hammingDistance(uint64_t a, uint64_t b);
+
+// Multi-index hashing over 64-bit hashes. Each hash is split into `substrings` disjoint pieces with one
+// table per piece; two hashes within Hamming distance r agree within r / substrings bits on at least one
+// piece, so a query probes only the buckets that close to its own pieces and verifies what it finds there.
+// Each table is kept as sorted keys with bucket offsets into one id array, so it saves and loads as is.
+class MultiIndexHash {
+public:
+    explicit MultiIndexHash(int substrings = 4);
+
+    void build(const std::vector<std::pair<std::string, Mat>>& hashes);
+    // Appends without touching the tables; call index() once the last hash is in
+    void add(const std::string& name, uint64_t hash);
+    void index();
+    // Every stored hash within `radius` bits of the query, nearest first
+    std::vector<std::pair<std::string, int>> search(uint64_t query, int radius) const;
+
+    // Binary layout: "VIRH" | source stamp | uint32 substrings | uint64 count | uint64 hashes[count]
+    //   | uint64 name offsets[count + 1] | name bytes | per table: uint64 keys | keys | starts[keys + 1] | ids[count]
+    bool save(const std::string& filename, const SourceStamp& source) const;
+    // Only loads an index saved from the store with the given stamp
+    bool load(const std::string& filename, const SourceStamp& source);
+
+    size_t size() const { return hashes_.size(); }
+    size_t memoryBytes() const;
+
+private:
+    struct Table {
+        std::vector<uint32_t> keys;
+        std::vector<uint32_t> starts;
+        std::vector<uint32_t> ids;
+    };
+
+    uint32_t piece(uint64_t hash, int index) const;
+    void probe(int table, uint32_t key, int bit, int flipsLeft, std::vector<uint32_t>& candidates) const;
+
+    int substrings_;
+    int pieceBits_;
+    std::vector<std::string> names_;
+    std::vector<uint64_t> hashes_;
+    std::vector<Table> tables_;
+};
+
+// Loads the persisted index of a dataset's hash store, rebuilding and saving it when it is missing or stale
+bool loadHashIndex(MultiIndexHash& index, FeatureDatabase& db, const std::string& dataset, std::string path);
+std::vector<std::pair<std::string, int>> findNearDuplicates(const Mat& image, const MultiIndexHash& index, int radius, int numResults);
+std::vector<std::pair<std::string, int>> findNearDuplicates(const Mat& image, FeatureDatabase db, const std::string& dataset, std::string path, int radius, int numResults);
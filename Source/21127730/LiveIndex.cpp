@@ -0,0 +1,269 @@
+#include "LiveIndex.hpp"
+#include <queue>
+
+bool IndexSnapshot::isLive(const std::string& name, uint64_t segmentGeneration) const {
+    auto tombstone = tombstones.find(name);
+    return tombstone == tombstones.end() || tombstone->second < segmentGeneration;
+}
+
+size_t IndexSnapshot::liveCount() const {
+    size_t count = 0;
+    for (const auto& segment : segments) {
+        for (const auto& name : segment->features.names) {
+            count += isLive(name, segment->generation) ? 1 : 0;
+        }
+    }
+    return count;
+}
+
+LiveIndex::LiveIndex(FeatureDatabase db, const std::string& featureType, const std::string& dataset, const std::string& path, const Mat& centers)
+    : db_(db), featureType_(featureType), dataset_(dataset), path_(path), centers_(centers) {
+    // Local features are served from their BoVW histograms
+    storeType_ = centers.empty() ? featureType : featureType + "_histogram";
+    memory_ = MemoryHandle("index/live_" + storeType_, 0);
+    std::atomic_store(&current_, std::shared_ptr<const IndexSnapshot>(std::make_shared<IndexSnapshot>()));
+}
+
+LiveIndex::~LiveIndex() {
+    stopCompaction();
+}
+
+std::shared_ptr<const IndexSnapshot> LiveIndex::snapshot() const {
+    return std::atomic_load(&current_);
+}
+
+void LiveIndex::publish(std::shared_ptr<const IndexSnapshot> next) {
+    size_t bytes = next->tombstones.size() * (sizeof(std::string) + sizeof(uint64_t));
+    size_t rows = 0;
+    for (const auto& segment : next->segments) {
+        bytes += matBytes(segment->features.data) + segment->features.names.capacity() * sizeof(std::string);
+        rows += segment->features.names.size();
+    }
+    memory_.update(bytes, rows);
+
+    std::atomic_store(&current_, next);
+}
+
+// The persisted store becomes the first segment
+bool LiveIndex::load() {
+    FeatureMatrix features = packFeatures(db_.loadFeatures(storeType_, dataset_, path_));
+    if (features.data.empty()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    auto next = std::make_shared<IndexSnapshot>(*snapshot());
+    auto segment = std::make_shared<IndexSegment>();
+    segment->features = std::move(features);
+    segment->generation = ++next->generation;
+    next->segments.push_back(segment);
+    publish(next);
+
+    std::cout << "Live index loaded " << segment->features.names.size() << " images" << std::endl;
+    return true;
+}
+
+Mat LiveIndex::queryFeature(const Mat& image) const {
+    Mat feature = extractFeaturesFromImage(image, featureType_);
+    if (!centers_.empty() && !feature.empty()) {
+        feature = CalculateQueryHistograms(feature, centers_);
+    }
+    return feature;
+}
+
+bool LiveIndex::insert(const std::string& name, const Mat& image) {
+    TRACE_SCOPE("live_insert");
+    // Extraction and encoding run outside the writer lock; only publication is serialized
+    Mat feature = queryFeature(image);
+    if (feature.empty()) {
+        std::cerr << "Feature extraction failed for image: " << name << std::endl;
+        return false;
+    }
+
+    auto segment = std::make_shared<IndexSegment>();
+    segment->features = packFeatures({ { name, feature } });
+
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    std::shared_ptr<const IndexSnapshot> current = snapshot();
+    if (!current->segments.empty() && current->segments.front()->features.data.cols != segment->features.data.cols) {
+        std::cerr << "Feature size does not match the index: " << name << std::endl;
+        return false;
+    }
+
+    // Re-inserting a name replaces the older row
+    auto next = std::make_shared<IndexSnapshot>(*current);
+    next->tombstones[name] = next->generation;
+    segment->generation = ++next->generation;
+    next->segments.push_back(segment);
+    publish(next);
+    return true;
+}
+
+bool LiveIndex::insert(const std::string& imagePath) {
+    Mat image = cv::imread(imagePath, cv::IMREAD_COLOR);
+    if (image.empty()) {
+        std::cerr << "Failed to read image: " << imagePath << std::endl;
+        return false;
+    }
+    return insert(imagePath, image);
+}
+
+bool LiveIndex::remove(const std::string& name) {
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    auto next = std::make_shared<IndexSnapshot>(*snapshot());
+    next->tombstones[name] = next->generation;
+    publish(next);
+    return true;
+}
+
+std::vector<std::pair<std::string, double>> LiveIndex::search(const Mat& queryFeature, int numResults) const {
+    typedef std::pair<double, std::pair<const IndexSegment*, int>> ScoredRow;
+    std::priority_queue<ScoredRow, std::vector<ScoredRow>, std::greater<ScoredRow>> heap;
+
+    // The pinned snapshot keeps every segment alive for the whole scan, even if it is compacted away meanwhile
+    std::shared_ptr<const IndexSnapshot> pinned = snapshot();
+    std::vector<std::pair<std::string, double>> results;
+    if (pinned->segments.empty() || numResults <= 0) {
+        return results;
+    }
+
+    int dims = pinned->segments.front()->features.data.cols;
+    if (static_cast<int>(queryFeature.total()) != dims) {
+        std::cerr << "Query does not match the index feature size." << std::endl;
+        return results;
+    }
+
+    Mat query;
+    queryFeature.reshape(1, 1).convertTo(query, CV_32F);
+    CosineKernel kernel = selectCosineKernel(dims, CV_32F);
+
+    TRACE_SCOPE("live_search");
+    for (const auto& segment : pinned->segments) {
+        const FeatureMatrix& features = segment->features;
+        for (int row = 0; row < features.data.rows; ++row) {
+            if (!pinned->isLive(features.names[row], segment->generation)) {
+                continue;
+            }
+
+            double score = kernel(query.ptr(), features.data.ptr(row), dims);
+            if (static_cast<int>(heap.size()) < numResults) {
+                heap.push({ score, { segment.get(), row } });
+            }
+            else if (score > heap.top().first) {
+                heap.pop();
+                heap.push({ score, { segment.get(), row } });
+            }
+        }
+    }
+
+    results.resize(heap.size());
+    for (int i = static_cast<int>(heap.size()) - 1; i >= 0; --i) {
+        results[i] = { heap.top().second.first->features.names[heap.top().second.second], heap.top().first };
+        heap.pop();
+    }
+    return results;
+}
+
+// Merge every segment of a pinned snapshot into one, dropping deleted rows, then swap it in and persist.
+// Inserts and deletes published while merging are kept: newer segments are carried over and tombstones
+// at or after the merged generation still apply to the merged rows.
+void LiveIndex::compact() {
+    TRACE_SCOPE("live_compact");
+    std::lock_guard<std::mutex> mergeLock(mergeMutex_);
+    std::shared_ptr<const IndexSnapshot> base = snapshot();
+    if (base->segments.size() <= 1 && base->tombstones.empty()) {
+        return;
+    }
+
+    auto merged = std::make_shared<IndexSegment>();
+    merged->generation = 0;
+    std::vector<Mat> rows;
+    for (const auto& segment : base->segments) {
+        merged->generation = std::max(merged->generation, segment->generation);
+        for (int row = 0; row < segment->features.data.rows; ++row) {
+            if (base->isLive(segment->features.names[row], segment->generation)) {
+                merged->features.names.push_back(segment->features.names[row]);
+                rows.push_back(segment->features.data.row(row));
+            }
+        }
+    }
+    if (!rows.empty()) {
+        cv::vconcat(rows, merged->features.data);
+    }
+
+    std::shared_ptr<const IndexSnapshot> published;
+    {
+        std::lock_guard<std::mutex> lock(writerMutex_);
+        std::shared_ptr<const IndexSnapshot> current = snapshot();
+        auto next = std::make_shared<IndexSnapshot>();
+        next->generation = current->generation;
+        if (!merged->features.names.empty()) {
+            next->segments.push_back(merged);
+        }
+        for (const auto& segment : current->segments) {
+            if (segment->generation > merged->generation) {
+                next->segments.push_back(segment);
+            }
+        }
+        for (const auto& tombstone : current->tombstones) {
+            if (tombstone.second >= merged->generation) {
+                next->tombstones.insert(tombstone);
+            }
+        }
+        publish(next);
+        published = next;
+    }
+
+    // Persist the live rows of what was just published
+    std::vector<std::pair<std::string, Mat>> features;
+    for (const auto& segment : published->segments) {
+        for (int row = 0; row < segment->features.data.rows; ++row) {
+            if (published->isLive(segment->features.names[row], segment->generation)) {
+                features.emplace_back(segment->features.names[row], segment->features.data.row(row));
+            }
+        }
+    }
+    // saveFeatures renames a complete temporary file over the store, so a crash here keeps the previous copy
+    if (!db_.saveFeatures(features, storeType_, dataset_, path_)) {
+        std::cerr << "Failed to persist the compacted index, the previous store is unchanged" << std::endl;
+        return;
+    }
+    std::cout << "Compacted " << base->segments.size() << " segments into " << published->segments.size()
+        << ", " << features.size() << " images persisted" << std::endl;
+}
+
+void LiveIndex::startCompaction(std::chrono::milliseconds interval, size_t maxSegments) {
+    stopCompaction();
+    {
+        std::lock_guard<std::mutex> lock(compactionMutex_);
+        running_ = true;
+    }
+
+    compactor_ = std::thread([this, interval, maxSegments]() {
+        std::unique_lock<std::mutex> lock(compactionMutex_);
+        while (running_) {
+            compactionSignal_.wait_for(lock, interval, [this]() { return !running_; });
+            if (!running_) {
+                break;
+            }
+
+            std::shared_ptr<const IndexSnapshot> current = snapshot();
+            if (current->segments.size() > maxSegments) {
+                lock.unlock();
+                compact();
+                lock.lock();
+            }
+        }
+    });
+}
+
+void LiveIndex::stopCompaction() {
+    {
+        std::lock_guard<std::mutex> lock(compactionMutex_);
+        running_ = false;
+    }
+    compactionSignal_.notify_all();
+    if (compactor_.joinable()) {
+        compactor_.join();
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "Database.hpp"
+#include "Codebook.hpp"
+#include "Processing.hpp"
+#include "SimilarityKernels.hpp"
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Immutable block of indexed images; rows of a segment all carry the generation it was published at
+struct IndexSegment {
+    FeatureMatrix features;
+    uint64_t generation;
+};
+
+// Everything a reader needs, frozen at publication time. A row is deleted when its name was
+// tombstoned at a generation at or after the generation of the row's segment.
+struct IndexSnapshot {
+    std::vector<std::shared_ptr<const IndexSegment>> segments;
+    std::unordered_map<std::string, uint64_t> tombstones;
+    uint64_t generation = 0;
+
+    bool isLive(const std::string& name, uint64_t segmentGeneration) const;
+    size_t liveCount() const;
+};
+
+// In-memory index that takes inserts and deletes while queries run. Readers pin a snapshot and scan it
+// without locks; writers serialize among themselves, build a new snapshot and publish it atomically.
+class LiveIndex {
+public:
+    LiveIndex(FeatureDatabase db, const std::string& featureType, const std::string& dataset, const std::string& path, const Mat& centers);
+    ~LiveIndex();
+
+    bool load();
+    bool insert(const std::string& name, const Mat& image);
+    bool insert(const std::string& imagePath);
+    bool remove(const std::string& name);
+
+    std::shared_ptr<const IndexSnapshot> snapshot() const;
+    Mat queryFeature(const Mat& image) const;
+    std::vector<std::pair<std::string, double>> search(const Mat& queryFeature, int numResults) const;
+
+    void compact();
+    void startCompaction(std::chrono::milliseconds interval, size_t maxSegments);
+    void stopCompaction();
+
+private:
+    void publish(std::shared_ptr<const IndexSnapshot> next);
+
+    FeatureDatabase db_;
+    std::string featureType_;
+    std::string storeType_;
+    std::string dataset_;
+    std::string path_;
+    Mat centers_;
+    MemoryHandle memory_;
+
+    // Only touched through std::atomic_load / std::atomic_store
+    std::shared_ptr<const IndexSnapshot> current_;
+
+    std::mutex writerMutex_;
+    std::mutex mergeMutex_;
+    std::mutex compactionMutex_;
+    std::condition_variable compactionSignal_;
+    std::thread compactor_;
+    bool running_ = false;
+};
@@ -15,8 +15,10 @@ Mat SIFTFeatureExtractor::extractFeature(const Mat& image) {
         grayImage = image;
     }
 
-    // Initialize SIFT detector
-    auto sift = SIFT::create();
+    // Initialize SIFT detector once per extractor, so a pooled extractor reuses it
+    if (!sift) {
+        sift = SIFT::create();
+    }
 
     // Detect keypoints and compute descriptors
     std::vector<KeyPoint> keypoints;
@@ -44,8 +46,10 @@ Mat ORBFeatureExtractor::extractFeature(const Mat& image) {
         grayImage = image;
     }
 
-    // Initialize ORB detector
-    Ptr<ORB> orb = ORB::create();
+    // Initialize ORB detector once per extractor
+    if (!orb) {
+        orb = ORB::create();
+    }
     std::vector<KeyPoint> keypoints;
     Mat descriptors;
     orb->detectAndCompute(grayImage, noArray(), keypoints, descriptors);
@@ -0,0 +1,162 @@
+#include "Memory.hpp"
+#include <iomanip>
+
+MemoryLedger& MemoryLedger::instance() {
+    static MemoryLedger ledger;
+    return ledger;
+}
+
+uint64_t MemoryLedger::acquire(const std::string& component, size_t bytes, size_t items) {
+    uint64_t id = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        id = nextId_++;
+        entries_[id].component = component;
+        components_[component].name = component;
+    }
+    update(id, bytes, items);
+    return id;
+}
+
+void MemoryLedger::update(uint64_t id, size_t bytes, size_t items) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = entries_.find(id);
+    if (entry == entries_.end()) {
+        return;
+    }
+    MemoryComponent& component = components_[entry->second.component];
+    component.bytes = component.bytes - entry->second.bytes + bytes;
+    component.items = component.items - entry->second.items + items;
+    component.peak = std::max(component.peak, component.bytes);
+    total_ = total_ - entry->second.bytes + bytes;
+    peak_ = std::max(peak_, total_);
+    entry->second.bytes = bytes;
+    entry->second.items = items;
+}
+
+void MemoryLedger::release(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = entries_.find(id);
+    if (entry == entries_.end()) {
+        return;
+    }
+    // The component row stays behind with its peak, so short-lived structures still show up in the report
+    MemoryComponent& component = components_[entry->second.component];
+    component.bytes -= entry->second.bytes;
+    component.items -= entry->second.items;
+    total_ -= entry->second.bytes;
+    entries_.erase(entry);
+}
+
+size_t MemoryLedger::totalBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return total_;
+}
+
+size_t MemoryLedger::peakBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_;
+}
+
+void MemoryLedger::printReport(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out << std::left << std::setw(40) << "Component" << std::right << std::setw(12) << "Items" << std::setw(14) << "Memory"
+        << std::setw(14) << "Peak" << std::endl;
+    for (const auto& entry : components_) {
+        out << std::left << std::setw(40) << entry.first << std::right << std::setw(12) << entry.second.items
+            << std::setw(14) << formatBytes(entry.second.bytes) << std::setw(14) << formatBytes(entry.second.peak) << std::endl;
+    }
+    out << std::left << std::setw(52) << "Total" << std::right << std::setw(14) << formatBytes(total_) << std::endl;
+    out << std::left << std::setw(52) << "Peak" << std::right << std::setw(14) << formatBytes(peak_) << std::endl;
+}
+
+MemoryHandle::MemoryHandle(const std::string& component, size_t bytes, size_t items)
+    : id_(MemoryLedger::instance().acquire(component, bytes, items)) {
+}
+
+MemoryHandle::~MemoryHandle() {
+    reset();
+}
+
+MemoryHandle::MemoryHandle(MemoryHandle&& other) noexcept : id_(other.id_) {
+    other.id_ = 0;
+}
+
+MemoryHandle& MemoryHandle::operator=(MemoryHandle&& other) noexcept {
+    if (this != &other) {
+        reset();
+        id_ = other.id_;
+        other.id_ = 0;
+    }
+    return *this;
+}
+
+void MemoryHandle::update(size_t bytes, size_t items) {
+    if (id_ != 0) {
+        MemoryLedger::instance().update(id_, bytes, items);
+    }
+}
+
+void MemoryHandle::reset() {
+    if (id_ != 0) {
+        MemoryLedger::instance().release(id_);
+        id_ = 0;
+    }
+}
+
+// Views share their parent's buffer, but every store here owns its rows, so the element bytes are what is held
+size_t matBytes(const cv::Mat& mat) {
+    return mat.total() * mat.elemSize();
+}
+
+size_t featureBytes(const std::vector<std::pair<std::string, cv::Mat>>& features) {
+    size_t bytes = features.capacity() * sizeof(std::pair<std::string, cv::Mat>);
+    for (const auto& feature : features) {
+        bytes += matBytes(feature.second);
+    }
+    return bytes;
+}
+
+// Names shorter than the small-string buffer live inside the pair and are already counted above
+size_t nameBytes(const std::vector<std::pair<std::string, cv::Mat>>& features) {
+    size_t bytes = 0;
+    for (const auto& feature : features) {
+        if (feature.first.capacity() >= sizeof(std::string)) {
+            bytes += feature.first.capacity() + 1;
+        }
+    }
+    return bytes;
+}
+
+MemoryHandle trackFeatureStore(const std::string& featureType, const std::vector<std::pair<std::string, cv::Mat>>& features) {
+    return MemoryHandle("features/" + featureType, featureBytes(features) + nameBytes(features), features.size());
+}
+
+size_t thumbnailBytes(const std::vector<std::pair<std::string, std::vector<uchar>>>& thumbnails) {
+    size_t bytes = 0;
+    for (const auto& thumbnail : thumbnails) {
+        bytes += thumbnail.first.capacity() + thumbnail.second.capacity();
+    }
+    return bytes;
+}
+
+size_t thumbnailBytes(const std::unordered_map<std::string, std::vector<uchar>>& thumbnails) {
+    size_t bytes = 0;
+    for (const auto& thumbnail : thumbnails) {
+        bytes += thumbnail.first.capacity() + thumbnail.second.capacity();
+    }
+    return bytes;
+}
+
+std::string formatBytes(size_t bytes) {
+    static const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 4) {
+        value /= 1024.0;
+        ++unit;
+    }
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << value << " " << units[unit];
+    return text.str();
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bytes owned by one part of the process, e.g. "features/sift" or "codebook/sift_codebook_CD"
+struct MemoryComponent {
+    std::string name;
+    size_t bytes = 0;
+    size_t items = 0;
+    size_t peak = 0;
+};
+
+// Tracks the footprint of every large structure while it is alive, so a node can be sized from a
+// report instead of guessed. Entries are owned by MemoryHandle and disappear with the structure.
+class MemoryLedger {
+public:
+    static MemoryLedger& instance();
+
+    size_t totalBytes() const;
+    size_t peakBytes() const;
+    void printReport(std::ostream& out) const;
+
+private:
+    friend class MemoryHandle;
+    MemoryLedger() = default;
+
+    struct Entry {
+        std::string component;
+        size_t bytes = 0;
+        size_t items = 0;
+    };
+
+    uint64_t acquire(const std::string& component, size_t bytes, size_t items);
+    void update(uint64_t id, size_t bytes, size_t items);
+    void release(uint64_t id);
+
+    mutable std::mutex mutex_;
+    std::map<uint64_t, Entry> entries_;
+    std::map<std::string, MemoryComponent> components_;
+    uint64_t nextId_ = 1;
+    size_t total_ = 0;
+    size_t peak_ = 0;
+};
+
+// Accounts for one in-memory structure for as long as the handle lives; keep it next to what it measures
+class MemoryHandle {
+public:
+    MemoryHandle() = default;
+    MemoryHandle(const std::string& component, size_t bytes, size_t items = 0);
+    ~MemoryHandle();
+
+    MemoryHandle(MemoryHandle&& other) noexcept;
+    MemoryHandle& operator=(MemoryHandle&& other) noexcept;
+    MemoryHandle(const MemoryHandle&) = delete;
+    MemoryHandle& operator=(const MemoryHandle&) = delete;
+
+    void update(size_t bytes, size_t items = 0);
+    void reset();
+
+private:
+    uint64_t id_ = 0;
+};
+
+size_t matBytes(const cv::Mat& mat);
+size_t featureBytes(const std::vector<std::pair<std::string, cv::Mat>>& features);
+size_t nameBytes(const std::vector<std::pair<std::string, cv::Mat>>& features);
+size_t thumbnailBytes(const std::vector<std::pair<std::string, std::vector<uchar>>>& thumbnails);
+size_t thumbnailBytes(const std::unordered_map<std::string, std::vector<uchar>>& thumbnails);
+// One entry per store: rows and names together, so a store is never counted twice
+MemoryHandle trackFeatureStore(const std::string& featureType, const std::vector<std::pair<std::string, cv::Mat>>& features);
+std::string formatBytes(size_t bytes);
@@ -63,6 +63,18 @@ bool readConfig(const std::string& filename, std::unordered_map<std::string, std
     return true;
 }
 
+// Read a config value, falling back to a default when the section or key is missing
+std::string getConfigValue(std::unordered_map<std::string, std::unordered_map<std::string, std::string>>& config, const std::string& section, const std::string& key, const std::string& defaultValue) {
+    auto sectionIt = config.find(section);
+    if (sectionIt == config.end())
+        return defaultValue;
+
+    auto valueIt = sectionIt->second.find(key);
+    if (valueIt == sectionIt->second.end() || valueIt->second.empty())
+        return defaultValue;
+    return valueIt->second;
+}
+
 bool checkExist(const std::set<std::string> features, std::string feature) {
     auto check = features.find(feature);
     if (check == features.end())
@@ -72,6 +84,7 @@ bool checkExist(const std::set<std::string> features, std::string feature) {
 
 
 Mat extractFeaturesFromImage(const Mat& image, const std::string& featureType) {
+    TRACE_SCOPE("extract");
     std::unique_ptr<FeatureExtractorInterface> featureExtractor = FeatureFactory::createFeature(featureType);
 
     Mat extractedFeatures;
@@ -81,6 +94,7 @@ Mat extractFeaturesFromImage(const Mat& image, const std::string& featureType) {
         }
 
         extractedFeatures = featureExtractor->extractFeature(image);
+        TRACE_COUNTER("descriptors_per_image", extractedFeatures.rows);
     }
     catch (const std::exception& e) {
         std::cerr << "Error extracting features: " << e.what() << std::endl;
@@ -89,47 +103,272 @@ Mat extractFeaturesFromImage(const Mat& image, const std::string& featureType) {
     return extractedFeatures;
 }
 
-void extractAndSaveFeatures(FeatureDatabase db, std::string folderPath, std::string featureType, std::string dataset, std::string path) {
-    std::vector<std::pair<std::string, Mat>> allExtractedFeatures;
+// Downscale an image to fit a fixed square cell
+Mat fitThumbnail(const Mat& image, int thumbnailSize) {
+    if (image.empty() || thumbnailSize <= 0) {
+        return Mat();
+    }
+
+    double scale = std::min(static_cast<double>(thumbnailSize) / image.cols, static_cast<double>(thumbnailSize) / image.rows);
+    int width = std::max(1, static_cast<int>(image.cols * scale));
+    int height = std::max(1, static_cast<int>(image.rows * scale));
+
+    Mat resized;
+    cv::resize(image, resized, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+
+    // Pad to the fixed cell size so the montage never needs the original dimensions
+    Mat thumbnail = Mat::zeros(thumbnailSize, thumbnailSize, image.type());
+    resized.copyTo(thumbnail(cv::Rect((thumbnailSize - width) / 2, (thumbnailSize - height) / 2, width, height)));
+    return thumbnail;
+}
+
+// Thumbnails are stored JPEG-encoded to keep the cache compact
+std::vector<uchar> makeThumbnail(const Mat& image, int thumbnailSize) {
+    std::vector<uchar> encoded;
+    Mat thumbnail = fitThumbnail(image, thumbnailSize);
+    if (!thumbnail.empty()) {
+        cv::imencode(".jpg", thumbnail, encoded, { cv::IMWRITE_JPEG_QUALITY, 85 });
+    }
+    return encoded;
+}
+
+ExtractionSink::ExtractionSink(FeatureDatabase& db, const std::string& featureType, const std::string& dataset, const std::string& path, int thumbnailSize, bool withSignature, bool sortByName)
+    : db_(db), featureType_(featureType), dataset_(dataset), path_(path), thumbnailSize_(thumbnailSize),
+    withSignature_(withSignature && featureType != "signature"), sortByName_(sortByName), pendingMemory_("extract/" + featureType, 0) {
+}
+
+void ExtractionSink::add(const std::string& name, const Mat& feature, const Mat& signature, std::vector<uchar> thumbnail) {
+    if (!thumbnail.empty()) {
+        pendingBytes_ += name.capacity() + thumbnail.capacity();
+        thumbnails_.emplace_back(name, std::move(thumbnail));
+    }
+    if (!signature.empty()) {
+        signatures_.emplace_back(name, signature);
+        pendingBytes_ += matBytes(signature);
+    }
+    if (!feature.empty()) {
+        features_.emplace_back(name, feature);
+        pendingBytes_ += matBytes(feature);
+    }
+
+    pendingMemory_.update(pendingBytes_, features_.size());
+    size_t ceiling = db_.getMemoryCeiling();
+    if (ceiling > 0 && pendingBytes_ > ceiling / 2) {
+        if (!featureWriter_) {
+            std::cout << "Memory ceiling reached, streaming features to disk" << std::endl;
+            openWriters();
+        }
+        flush();
+    }
+}
+
+void ExtractionSink::openWriters() {
+    featureWriter_.reset(new FeatureWriter(db_.featureFilename(featureType_, dataset_, path_), db_.getSparseDensity()));
+    if (withSignature_) {
+        signatureWriter_.reset(new FeatureWriter(db_.featureFilename("signature", dataset_, path_), db_.getSparseDensity()));
+    }
+    if (thumbnailSize_ > 0) {
+        thumbnailWriter_.reset(new ThumbnailWriter(db_.thumbnailFilename(dataset_, path_), thumbnailSize_));
+    }
+}
+
+// Under a ceiling the order is stable within each flushed batch only
+void ExtractionSink::flush() {
+    TRACE_SCOPE("db_save");
+    if (sortByName_) {
+        auto byName = [](const auto& a, const auto& b) { return a.first < b.first; };
+        std::sort(features_.begin(), features_.end(), byName);
+        std::sort(signatures_.begin(), signatures_.end(), byName);
+        std::sort(thumbnails_.begin(), thumbnails_.end(), byName);
+    }
+
+    for (const auto& feature : features_) {
+        featureWriter_->write(feature.first, feature.second);
+    }
+    if (signatureWriter_) {
+        for (const auto& signature : signatures_) {
+            signatureWriter_->write(signature.first, signature.second);
+        }
+    }
+    if (thumbnailWriter_) {
+        for (const auto& thumbnail : thumbnails_) {
+            thumbnailWriter_->write(thumbnail.first, thumbnail.second);
+        }
+    }
+    features_.clear();
+    signatures_.clear();
+    thumbnails_.clear();
+    pendingBytes_ = 0;
+    pendingMemory_.update(0);
+}
+
+bool ExtractionSink::commit() {
+    if (!featureWriter_) {
+        if (features_.empty()) {
+            std::cerr << "No features extracted, stores left unchanged" << std::endl;
+            return false;
+        }
+        openWriters();
+    }
+    flush();
+
+    // Every store is finished before any replaces its predecessor, so a failed write keeps all previous ones
+    bool finished = featureWriter_->finish();
+    if (signatureWriter_) {
+        finished = signatureWriter_->finish() && finished;
+    }
+    if (thumbnailWriter_) {
+        finished = thumbnailWriter_->finish() && finished;
+    }
+    if (!finished) {
+        std::cerr << "Failed to write the " << featureType_ << " stores, previous stores left unchanged" << std::endl;
+        return false;
+    }
+
+    bool committed = featureWriter_->commit();
+    if (signatureWriter_) {
+        committed = signatureWriter_->commit() && committed;
+    }
+    if (thumbnailWriter_) {
+        committed = thumbnailWriter_->commit() && committed;
+    }
+    return committed;
+}
+
+void extractAndSaveFeatures(FeatureDatabase db, std::string folderPath, std::string featureType, std::string dataset, std::string path, int thumbnailSize, bool withSignature) {
+    ExtractionSink sink(db, featureType, dataset, path, thumbnailSize, withSignature);
+
+    auto processImage = [&](const std::string& imagePath, const Mat& image) {
+        std::vector<uchar> thumbnail;
+        if (thumbnailSize > 0) {
+            TRACE_SCOPE("thumbnail");
+            thumbnail = makeThumbnail(image, thumbnailSize);
+        }
+
+        // The cascade prefilter signature is cheap, so it is refreshed with every extraction
+        Mat signature;
+        if (withSignature && featureType != "signature") {
+            signature = extractFeaturesFromImage(image, "signature");
+        }
+
+        Mat extractedFeatures = extractFeaturesFromImage(image, featureType);
+        if (extractedFeatures.empty()) {
+            std::cerr << "Feature extraction failed for image: " << imagePath << std::endl;
+        }
+        sink.add(imagePath, extractedFeatures, signature, std::move(thumbnail));
+    };
 
-    for (const auto& entry : std::filesystem::directory_iterator(folderPath)) {
-        if (entry.is_regular_file()) {
-            std::string imagePath = entry.path().string();
-            std::cout << "Processing file: " << imagePath << std::endl;
+    if (isTarArchive(folderPath)) {
+        // Members are decoded straight from memory and stored under their name inside the archive
+        TarReader archive(folderPath);
+        TarMember member;
+        while (archive.isOpen() && archive.next(member)) {
+            std::cout << "Processing member: " << member.name << std::endl;
 
-            Mat image = cv::imread(imagePath, cv::IMREAD_COLOR);
+            Mat image;
+            {
+                TRACE_SCOPE("decode");
+                image = cv::imdecode(member.data, cv::IMREAD_COLOR);
+            }
             if (image.empty()) {
-                std::cerr << "Failed to read image: " << imagePath << std::endl;
+                std::cerr << "Failed to decode member: " << member.name << std::endl;
                 continue;
             }
+            processImage(member.name, image);
+        }
+    }
+    else {
+        for (const auto& entry : std::filesystem::directory_iterator(folderPath)) {
+            if (entry.is_regular_file()) {
+                std::string imagePath = entry.path().string();
+                std::cout << "Processing file: " << imagePath << std::endl;
 
-            Mat extractedFeatures = extractFeaturesFromImage(image, featureType);
-            if (!extractedFeatures.empty()) {
-                allExtractedFeatures.push_back(std::make_pair(imagePath, extractedFeatures));
+                Mat image;
+                {
+                    TRACE_SCOPE("decode");
+                    image = cv::imread(imagePath, cv::IMREAD_COLOR);
+                }
+                if (image.empty()) {
+                    std::cerr << "Failed to read image: " << imagePath << std::endl;
+                    continue;
+                }
+                processImage(imagePath, image);
             }
             else {
-                std::cerr << "Feature extraction failed for image: " << imagePath << std::endl;
+                std::cerr << "Not a regular file: " << entry.path() << std::endl;
             }
         }
-        else {
-            std::cerr << "Not a regular file: " << entry.path() << std::endl;
-        }
     }
 
-    if (!allExtractedFeatures.empty()) {
-        db.saveFeatures(allExtractedFeatures, featureType, dataset, path);
+    if (!sink.commit()) {
+        return;
     }
-
     std::cout << "Features extracted and saved successfully!\n";
 }
 
+// Uniform reservoir sample of descriptor rows that fits in maxBytes, read from the store one chunk at a time
+static Mat sampleDescriptors(FeatureDatabase& db, const std::string& featureType, const std::string& dataset, const std::string& path, size_t maxBytes) {
+    Mat sample;
+    int capacity = 0;
+    int filled = 0;
+    size_t seen = 0;
+    cv::RNG rng(42);
+
+    db.forEachFeatureChunk(featureType, dataset, path, maxBytes, [&](std::vector<std::pair<std::string, Mat>>& chunk) {
+        for (const auto& feature : chunk) {
+            Mat rows;
+            feature.second.convertTo(rows, CV_32F);
+            if (rows.empty()) {
+                continue;
+            }
+            if (sample.empty()) {
+                capacity = std::max(1, static_cast<int>(maxBytes / (rows.cols * sizeof(float))));
+                sample.create(capacity, rows.cols, CV_32F);
+            }
+            if (rows.cols != sample.cols) {
+                std::cerr << "Skipping feature with mismatched size: " << feature.first << std::endl;
+                continue;
+            }
+
+            for (int r = 0; r < rows.rows; ++r, ++seen) {
+                if (filled < capacity) {
+                    rows.row(r).copyTo(sample.row(filled++));
+                    continue;
+                }
+                size_t slot = static_cast<size_t>(rng.uniform(0.0, 1.0) * (seen + 1));
+                if (slot < static_cast<size_t>(capacity)) {
+                    rows.row(r).copyTo(sample.row(static_cast<int>(slot)));
+                }
+            }
+        }
+    });
+
+    std::cout << "Sampled " << filled << " of " << seen << " descriptors\n";
+    return filled > 0 ? sample.rowRange(0, filled) : Mat();
+}
+
 void clusterAndSaveCodebook(FeatureDatabase db, std::string featureType, std::string dataset, int k, std::string path) {
-    std::cout << "Loading features...\n";
-    std::vector<std::pair<std::string, Mat>> features = db.loadFeatures(featureType, dataset, path);
+    Mat centers;
+    if (db.exceedsMemoryCeiling(featureType, dataset, path)) {
+        // k-means needs every row in one matrix (plus a copy), so it gets a sample sized to a quarter of the ceiling
+        std::cout << "Store exceeds the memory ceiling, sampling descriptors...\n";
+        Mat sample = sampleDescriptors(db, featureType, dataset, path, db.getMemoryCeiling() / 4);
+        if (sample.empty()) {
+            std::cerr << "No descriptors to cluster." << std::endl;
+            return;
+        }
 
-    std::cout << "Clustering\n";
-    // Clustering features
-    Mat centers = ClusteringFeature(features, k);
+        std::cout << "Clustering\n";
+        centers = ClusteringFeature({ { featureType, sample } }, k);
+    }
+    else {
+        std::cout << "Loading features...\n";
+        std::vector<std::pair<std::string, Mat>> features = db.loadFeatures(featureType, dataset, path);
+
+        std::cout << "Clustering\n";
+        // Clustering features
+        centers = ClusteringFeature(features, k);
+    }
 
     std::string file_name = path + featureType + "_codebook_" + dataset + ".xml";
 
@@ -139,17 +378,31 @@ void clusterAndSaveCodebook(FeatureDatabase db, std::string featureType, std::st
 }
 
 void plotAndSaveHistogram(FeatureDatabase db, std::string featureType, std::string dataset, std::string path) {
-    std::cout << "Loading features...\n";
-    std::vector<std::pair<std::string, Mat>> features = db.loadFeatures(featureType, dataset, path);
-
     std::string file_name = path + featureType + "_codebook_" + dataset + ".xml";
     Mat centers = readCodebookFromFile(file_name);
 
+    std::string name = featureType + "_histogram";
+
+    if (db.exceedsMemoryCeiling(featureType, dataset, path)) {
+        // Histograms are encoded and written chunk by chunk, so only one chunk of descriptors is ever held
+        std::cout << "Store exceeds the memory ceiling, calculating histograms in chunks\n";
+        FeatureWriter writer(db.featureFilename(name, dataset, path), db.getSparseDensity());
+        db.forEachFeatureChunk(featureType, dataset, path, db.getMemoryCeiling() / 2, [&](std::vector<std::pair<std::string, Mat>>& chunk) {
+            for (const auto& histogram : CalculateHistograms(chunk, centers)) {
+                writer.write(histogram.first, histogram.second);
+            }
+        });
+        writer.close();
+        std::cout << "Features extracted and saved successfully!\n";
+        return;
+    }
+
+    std::cout << "Loading features...\n";
+    std::vector<std::pair<std::string, Mat>> features = db.loadFeatures(featureType, dataset, path);
+
     std::cout << "Calculating histogram\n";
     std::vector<std::pair<std::string, Mat>> histograms = CalculateHistograms(features, centers);
 
-    std::string name = featureType + "_histogram";
-
     if (!histograms.empty()) {
         db.saveFeatures(histograms, name, dataset, path);
     }
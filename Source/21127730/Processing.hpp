@@ -1,17 +1,58 @@
 #pragma once
+#include "Archive.hpp"
 #include "Database.hpp"
 #include "Codebook.hpp"
 #include "FeatureExtractor.hpp"
 #include <opencv2/opencv.hpp>
 #include <filesystem>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <unordered_map>
 #include <vector>
 
 bool readConfig(const std::string& filename, std::unordered_map<std::string, std::unordered_map<std::string, std::string>>& config);
+std::vector<std::string> split(const std::string& str, char delimiter);
+std::string getConfigValue(std::unordered_map<std::string, std::unordered_map<std::string, std::string>>& config, const std::string& section, const std::string& key, const std::string& defaultValue);
 bool checkExist(const std::set<std::string> features, std::string feature);
 Mat extractFeaturesFromImage(const Mat& image, const std::string& featureType);
-void extractAndSaveFeatures(FeatureDatabase db, std::string folderPath, std::string featureType, std::string dataset, std::string path);
+Mat fitThumbnail(const Mat& image, int thumbnailSize);
+std::vector<uchar> makeThumbnail(const Mat& image, int thumbnailSize);
+// Collects the feature, signature and thumbnail rows of one extraction run. Under the database's memory
+// ceiling pending rows are streamed to temporary files as they pile up; none of the three stores is
+// replaced before commit(), and then only once all of them were written completely.
+class ExtractionSink {
+public:
+    ExtractionSink(FeatureDatabase& db, const std::string& featureType, const std::string& dataset, const std::string& path, int thumbnailSize, bool withSignature, bool sortByName = false);
+
+    // Empty rows are skipped, so callers pass whatever their extractors produced
+    void add(const std::string& name, const Mat& feature, const Mat& signature, std::vector<uchar> thumbnail);
+    bool commit();
+
+    ExtractionSink(const ExtractionSink&) = delete;
+    ExtractionSink& operator=(const ExtractionSink&) = delete;
+
+private:
+    void openWriters();
+    void flush();
+
+    FeatureDatabase& db_;
+    std::string featureType_;
+    std::string dataset_;
+    std::string path_;
+    int thumbnailSize_;
+    bool withSignature_;
+    bool sortByName_;
+    size_t pendingBytes_ = 0;
+    std::vector<std::pair<std::string, Mat>> features_;
+    std::vector<std::pair<std::string, Mat>> signatures_;
+    std::vector<std::pair<std::string, std::vector<uchar>>> thumbnails_;
+    std::unique_ptr<FeatureWriter> featureWriter_;
+    std::unique_ptr<FeatureWriter> signatureWriter_;
+    std::unique_ptr<ThumbnailWriter> thumbnailWriter_;
+    MemoryHandle pendingMemory_;
+};
+
+void extractAndSaveFeatures(FeatureDatabase db, std::string folderPath, std::string featureType, std::string dataset, std::string path, int thumbnailSize = 0, bool withSignature = false);
 void clusterAndSaveCodebook(FeatureDatabase db, std::string featureType, std::string dataset, int k, std::string path);
 void plotAndSaveHistogram(FeatureDatabase db, std::string featureType, std::string dataset, std::string path);
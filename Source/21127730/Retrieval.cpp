@@ -1,4 +1,10 @@
 #include "Retrieval.hpp"
+#include "VideoIngest.hpp"
+#include <numeric>
+#include <queue>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 
 bool compareByScore(const std::pair<std::string, double>& a, const std::pair<std::string, double>& b) {
@@ -14,21 +20,325 @@ double computeCosineSimilarity(const Mat& hist1, const Mat& hist2) {
     double normA = 0.0;
     double normB = 0.0;
 
-    for (int i = 0; i < hist1.rows; ++i) {
-        double bin_i = hist1.at<float>(i);
-        double bin_j = hist2.at<float>(i);
+    // Features are stored as single rows, so walk every element rather than the row count
+    for (size_t i = 0; i < hist1.total(); ++i) {
+        double bin_i = hist1.at<float>(static_cast<int>(i));
+        double bin_j = hist2.at<float>(static_cast<int>(i));
 
         dotProduct += bin_i * bin_j;
         normA += bin_i * bin_i;
         normB += bin_j * bin_j;
     }
 
+    if (normA == 0.0 || normB == 0.0) {
+        return 0.0;
+    }
+
     double similarity = dotProduct / (std::sqrt(normA) * std::sqrt(normB));
     return similarity;
 }
 
+// Score one stored feature with the kernel picked for the store; rows that do not fit it use the checked path
+double scoreWithKernel(CosineKernel kernel, const Mat& query, const Mat& feature) {
+    if (kernel && feature.total() == query.total() && feature.type() == query.type() && feature.isContinuous()) {
+        return kernel(query.ptr(), feature.ptr(), static_cast<int>(query.total()));
+    }
+    return computeCosineSimilarity(query, feature);
+}
+
+// Pick the kernel from the store's first row and bring the query to the same contiguous layout and type
+Mat prepareQueryForStore(const Mat& query, const std::vector<std::pair<std::string, Mat>>& databaseFeatures, CosineKernel& kernel) {
+    kernel = nullptr;
+    if (databaseFeatures.empty() || query.empty()) {
+        return query;
+    }
+
+    const Mat& header = databaseFeatures.front().second;
+    if (static_cast<int>(query.total()) != static_cast<int>(header.total())) {
+        return query;
+    }
+
+    Mat prepared;
+    query.reshape(1, 1).convertTo(prepared, header.type());
+    if (!prepared.isContinuous()) {
+        prepared = prepared.clone();
+    }
+    kernel = selectCosineKernel(static_cast<int>(header.total()), header.type());
+    return prepared;
+}
+
+// Score an in-memory feature store against the query and return the best matches with their scores
+std::vector<std::pair<std::string, double>> rankBySimilarity(const Mat& queryHistogram, const std::vector<std::pair<std::string, Mat>>& databaseFeatures, int numResults) {
+    std::vector<std::pair<std::string, double>> similarityScores;
+
+    // Compute similarity scores 
+    {
+        TRACE_SCOPE("score");
+        CosineKernel kernel;
+        Mat query = prepareQueryForStore(queryHistogram, databaseFeatures, kernel);
+
+        similarityScores.reserve(databaseFeatures.size());
+        for (const auto& dbFeature : databaseFeatures) {
+            double score = scoreWithKernel(kernel, query, dbFeature.second);
+            similarityScores.push_back({ dbFeature.first, score });
+        }
+        TRACE_COUNTER("rows_scanned", databaseFeatures.size());
+    }
+
+    // Sort similarity scores
+    {
+        TRACE_SCOPE("sort");
+        std::sort(similarityScores.begin(), similarityScores.end(), compareByScore);
+    }
+
+    // Keep top N results
+    if (static_cast<int>(similarityScores.size()) > numResults) {
+        similarityScores.resize(std::max(numResults, 0));
+    }
+
+    return similarityScores;
+}
+
+// Scan a mixed sparse/dense store: sparse rows gather from the dense query, and a sparse query is merged
+// with sparse rows or gathered into dense rows, so the work follows the non-zero bins
+std::vector<std::pair<std::string, double>> rankSparseBySimilarity(const Mat& queryHistogram, const SparseFeatureStore& store, int numResults, double sparseDensity) {
+    typedef std::pair<double, size_t> ScoredRow;
+    std::vector<std::pair<std::string, double>> results;
+    if (store.names.empty() || numResults <= 0) {
+        return results;
+    }
+    if (static_cast<int>(queryHistogram.total()) != store.dims) {
+        std::cerr << "Query does not match the database feature size." << std::endl;
+        return results;
+    }
+
+    Mat query;
+    queryHistogram.reshape(1, 1).convertTo(query, CV_32F);
+    double queryNorm = cv::norm(query);
+    if (queryNorm == 0) {
+        return results;
+    }
+
+    SparseVector sparseQuery = toSparse(query);
+    bool querySparse = sparseQuery.indices.size() < sparseDensity * store.dims;
+    CosineKernel kernel = selectCosineKernel(store.dims, CV_32F);
+    const float* queryData = query.ptr<float>(0);
+
+    TRACE_SCOPE("score_sparse");
+    std::priority_queue<ScoredRow, std::vector<ScoredRow>, std::greater<ScoredRow>> heap;
+    for (size_t row = 0; row < store.names.size(); ++row) {
+        if (store.norms[row] == 0) {
+            continue;
+        }
+
+        double score;
+        if (store.dense[row].empty()) {
+            double dotProduct = querySparse ? dotSparseSparse(sparseQuery, store.sparse[row]) : dotSparseDense(store.sparse[row], queryData);
+            score = dotProduct / (queryNorm * store.norms[row]);
+        }
+        else if (querySparse) {
+            score = dotSparseDense(sparseQuery, store.dense[row].ptr<float>(0)) / (queryNorm * store.norms[row]);
+        }
+        else {
+            score = kernel(queryData, store.dense[row].ptr(), store.dims);
+        }
+
+        if (static_cast<int>(heap.size()) < numResults) {
+            heap.push({ score, row });
+        }
+        else if (score > heap.top().first) {
+            heap.pop();
+            heap.push({ score, row });
+        }
+    }
+    TRACE_COUNTER("rows_scanned", store.names.size());
+
+    results.resize(heap.size());
+    for (int i = static_cast<int>(heap.size()) - 1; i >= 0; --i) {
+        results[i] = { store.names[heap.top().second], heap.top().first };
+        heap.pop();
+    }
+    return results;
+}
+
+// Scans a store too large for the memory ceiling one chunk at a time, merging each chunk's top-n into a running top-n
+std::vector<std::pair<std::string, double>> rankChunkedBySimilarity(const Mat& queryHistogram, FeatureDatabase& db, const std::string& featureType, const std::string& dataset, int numResults, std::string& path, size_t chunkBytes) {
+    std::vector<std::pair<std::string, double>> best;
+    auto byScore = [](const std::pair<std::string, double>& a, const std::pair<std::string, double>& b) { return a.second > b.second; };
+
+    db.forEachFeatureChunk(featureType, dataset, path, chunkBytes, [&](std::vector<std::pair<std::string, Mat>>& chunk) {
+        std::vector<std::pair<std::string, double>> scores = rankBySimilarity(queryHistogram, chunk, numResults);
+        best.insert(best.end(), scores.begin(), scores.end());
+        std::sort(best.begin(), best.end(), byScore);
+        if (static_cast<int>(best.size()) > numResults) {
+            best.resize(numResults);
+        }
+    });
+    return best;
+}
+
+// Out-of-core scan of a binary row store: a reader thread fills one chunk buffer while the other is scored,
+// so the scan runs at whichever of disk bandwidth and scoring is slower, never their sum
+std::vector<std::pair<std::string, double>> rankStreamedBySimilarity(const Mat& queryHistogram, const std::string& rowStoreFile, int numResults, size_t chunkBytes) {
+    TRACE_SCOPE("scan_streamed");
+    typedef std::pair<double, uint64_t> ScoredRow;
+    std::vector<std::pair<std::string, double>> results;
+
+    RowStoreReader reader(rowStoreFile);
+    if (!reader.isOpen() || numResults <= 0) {
+        return results;
+    }
+    if (static_cast<int>(queryHistogram.total()) != reader.dims()) {
+        std::cerr << "Query does not match the database feature size." << std::endl;
+        return results;
+    }
+
+    Mat query;
+    queryHistogram.reshape(1, 1).convertTo(query, CV_32F);
+    CosineKernel kernel = selectCosineKernel(reader.dims(), CV_32F);
+    int chunkRows = static_cast<int>(std::max<size_t>(1, chunkBytes / (reader.dims() * sizeof(float))));
+
+    struct Chunk {
+        Mat rows;
+        size_t count = 0;
+        uint64_t first = 0;
+        bool full = false;
+    };
+    Chunk chunks[2];
+    for (auto& chunk : chunks) {
+        chunk.rows.create(chunkRows, reader.dims(), CV_32F);
+    }
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool done = false;
+
+    std::thread io([&]() {
+        uint64_t next = 0;
+        for (int slot = 0; ; slot ^= 1) {
+            Chunk& chunk = chunks[slot];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return !chunk.full; });
+            }
+
+            size_t count;
+            {
+                TRACE_SCOPE("read_chunk");
+                count = reader.read(chunk.rows.ptr<float>(0), chunkRows);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                chunk.count = count;
+                chunk.first = next;
+                chunk.full = count > 0;
+                done = count == 0;
+            }
+            changed.notify_all();
+            next += count;
+            if (count == 0) {
+                break;
+            }
+        }
+    });
+
+    std::priority_queue<ScoredRow, std::vector<ScoredRow>, std::greater<ScoredRow>> heap;
+    const float* queryData = query.ptr<float>(0);
+    uint64_t scanned = 0;
+    for (int slot = 0; ; slot ^= 1) {
+        Chunk& chunk = chunks[slot];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return chunk.full || done; });
+            if (!chunk.full) {
+                break;
+            }
+        }
+
+        {
+            TRACE_SCOPE("score_chunk");
+            for (size_t row = 0; row < chunk.count; ++row) {
+                double score = kernel(queryData, chunk.rows.ptr<float>(static_cast<int>(row)), reader.dims());
+                if (static_cast<int>(heap.size()) < numResults) {
+                    heap.push({ score, chunk.first + row });
+                }
+                else if (score > heap.top().first) {
+                    heap.pop();
+                    heap.push({ score, chunk.first + row });
+                }
+            }
+        }
+        scanned += chunk.count;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            chunk.full = false;
+        }
+        changed.notify_all();
+    }
+    io.join();
+
+    // Throughput is bytes_scanned over the scan_streamed span in the trace
+    TRACE_COUNTER("rows_scanned", scanned);
+    TRACE_COUNTER("bytes_scanned", scanned * reader.dims() * sizeof(float));
+    if (reader.failed()) {
+        std::cerr << "Row store ended early, results cover the first " << scanned << " rows: " << rowStoreFile << std::endl;
+    }
+
+    // Only the winners' names are read, after the scan, from the table at the end of the file
+    results.resize(heap.size());
+    for (int i = static_cast<int>(heap.size()) - 1; i >= 0; --i) {
+        results[i] = { reader.nameAt(heap.top().second), heap.top().first };
+        heap.pop();
+    }
+    return results;
+}
+
+// Binary hashes are compared by Hamming distance through the hash index; every cosine scorer assumes float rows
+static bool rejectHashStore(const std::string& featureType) {
+    if (featureType != "phash") {
+        return false;
+    }
+    std::cerr << "phash is matched through the hash index, not by cosine similarity." << std::endl;
+    return true;
+}
+
 std::vector<std::string> findTopSimilarImages(const Mat& query_image, FeatureDatabase db, const Mat& queryHistogram, const std::string& featureType, const std::string& dataset, int numResults, std::string& path) {
     std::vector<std::string> topSimilarImages;
+    if (rejectHashStore(featureType)) {
+        return topSimilarImages;
+    }
+
+    bool overCeiling = db.exceedsMemoryCeiling(featureType, dataset, path);
+    std::string rowStore = db.rowStoreFilename(featureType, dataset, path);
+    if ((db.getStreamChunkBytes() > 0 || overCeiling) && db.ensureRowStore(featureType, dataset, path)) {
+        size_t chunkBytes = db.getStreamChunkBytes() > 0 ? db.getStreamChunkBytes() : db.getMemoryCeiling() / 4;
+        for (const auto& score : rankStreamedBySimilarity(queryHistogram, rowStore, numResults, chunkBytes)) {
+            topSimilarImages.push_back(score.first);
+        }
+        return topSimilarImages;
+    }
+
+    if (overCeiling) {
+        std::cout << "Store exceeds the memory ceiling, scanning in chunks" << std::endl;
+        for (const auto& score : rankChunkedBySimilarity(queryHistogram, db, featureType, dataset, numResults, path, db.getMemoryCeiling() / 2)) {
+            topSimilarImages.push_back(score.first);
+        }
+        return topSimilarImages;
+    }
+
+    if (db.getSparseDensity() > 0) {
+        SparseFeatureStore store = db.loadSparseFeatures(featureType, dataset, path);
+        if (store.names.empty()) {
+            std::cerr << "No features loaded from the database." << std::endl;
+            return topSimilarImages;
+        }
+        std::cout << store.sparseRows << " of " << store.names.size() << " stored features are sparse" << std::endl;
+
+        for (const auto& score : rankSparseBySimilarity(queryHistogram, store, numResults, db.getSparseDensity())) {
+            topSimilarImages.push_back(score.first);
+        }
+        return topSimilarImages;
+    }
 
     // Load database features
     std::vector<std::pair<std::string, Mat>> databaseFeatures = db.loadFeatures(featureType, dataset, path);
@@ -38,79 +348,386 @@ std::vector<std::string> findTopSimilarImages(const Mat& query_image, FeatureDat
         std::cerr << "No features loaded from the database." << std::endl;
         return topSimilarImages;
     }
+    MemoryHandle memory = trackFeatureStore(featureType, databaseFeatures);
 
-    std::vector<std::pair<std::string, double>> similarityScores;
+    std::vector<std::pair<std::string, double>> similarityScores = rankBySimilarity(queryHistogram, databaseFeatures, numResults);
+    if (similarityScores.empty()) {
+        std::cerr << "No matching features found in the database." << std::endl;
+        return topSimilarImages;
+    }
 
-    // Compute similarity scores 
-    for (const auto& dbFeature : databaseFeatures) {
-        double score = computeCosineSimilarity(queryHistogram, dbFeature.second);
-        similarityScores.push_back({ dbFeature.first, score });
+    // Retrieve top N results
+    for (const auto& score : similarityScores) {
+        topSimilarImages.push_back(score.first);
     }
 
-    // Sort similarity scores
-    if (!similarityScores.empty()) {
-        std::sort(similarityScores.begin(), similarityScores.end(), compareByScore);
+    return topSimilarImages;
+}
+
+// Score Q queries against the store in one pass: each tile of database rows is multiplied with the whole
+// query batch while it is still in cache, and every query keeps its own running top-n
+std::vector<std::vector<std::pair<std::string, double>>> rankBatchBySimilarity(const Mat& queries, const FeatureMatrix& store, int numResults, int tileRows) {
+    typedef std::pair<double, int> ScoredRow;
+    typedef std::priority_queue<ScoredRow, std::vector<ScoredRow>, std::greater<ScoredRow>> TopHeap;
+
+    std::vector<std::vector<std::pair<std::string, double>>> results(queries.rows);
+    if (queries.empty() || store.data.empty() || numResults <= 0) {
+        return results;
     }
-    else {
-        std::cerr << "No matching features found in the database." << std::endl;
+    CV_Assert(queries.cols == store.data.cols);
+
+    // L2-normalize the queries once so each tile product is already a cosine up to the database norm
+    Mat normalizedQueries;
+    queries.convertTo(normalizedQueries, CV_32F);
+    for (int q = 0; q < normalizedQueries.rows; ++q) {
+        double norm = cv::norm(normalizedQueries.row(q));
+        if (norm > 0) {
+            normalizedQueries.row(q) /= norm;
+        }
+    }
+
+    // Database norms come with the packed store; matrices assembled elsewhere get them computed here once
+    std::vector<double> computedNorms;
+    const std::vector<double>* norms = &store.norms;
+    if (store.norms.size() != static_cast<size_t>(store.data.rows)) {
+        computedNorms = rowNorms(store.data);
+        norms = &computedNorms;
+    }
+
+    std::vector<TopHeap> heaps(queries.rows);
+    Mat scores;
+    tileRows = std::max(1, tileRows);
+
+    TRACE_SCOPE("score_batch");
+    for (int begin = 0; begin < store.data.rows; begin += tileRows) {
+        int end = std::min(begin + tileRows, store.data.rows);
+        Mat tile = store.data.rowRange(begin, end);
+
+        // tile (T x D) * queries^T (D x Q) = T x Q dot products
+        cv::gemm(tile, normalizedQueries, 1.0, cv::noArray(), 0.0, scores, cv::GEMM_2_T);
+
+        for (int row = 0; row < tile.rows; ++row) {
+            double norm = (*norms)[begin + row];
+            if (norm == 0) {
+                continue;
+            }
+
+            const float* rowScores = scores.ptr<float>(row);
+            for (int q = 0; q < queries.rows; ++q) {
+                double score = rowScores[q] / norm;
+                TopHeap& heap = heaps[q];
+                if (static_cast<int>(heap.size()) < numResults) {
+                    heap.push({ score, begin + row });
+                }
+                else if (score > heap.top().first) {
+                    heap.pop();
+                    heap.push({ score, begin + row });
+                }
+            }
+        }
+    }
+    TRACE_COUNTER("rows_scanned", static_cast<double>(store.data.rows) * queries.rows);
+
+    for (int q = 0; q < queries.rows; ++q) {
+        TopHeap& heap = heaps[q];
+        results[q].resize(heap.size());
+        for (int i = static_cast<int>(heap.size()) - 1; i >= 0; --i) {
+            results[q][i] = { store.names[heap.top().second], heap.top().first };
+            heap.pop();
+        }
+    }
+
+    return results;
+}
+
+std::vector<std::vector<std::string>> findTopSimilarImagesBatch(const std::vector<Mat>& queryFeatures, FeatureDatabase db, const std::string& featureType, const std::string& dataset, int numResults, std::string& path, int batchSize, int tileRows) {
+    std::vector<std::vector<std::string>> topSimilarImages(queryFeatures.size());
+    if (rejectHashStore(featureType)) {
         return topSimilarImages;
     }
 
-    // Retrieve top N results
-    for (int i = 0; i < std::min(numResults, static_cast<int>(similarityScores.size())); ++i) {
-        topSimilarImages.push_back(similarityScores[i].first);
+    // Load database features once for every query
+    FeatureMatrix store = packFeatures(db.loadFeatures(featureType, dataset, path));
+    if (store.data.empty()) {
+        std::cerr << "No features loaded from the database." << std::endl;
+        return topSimilarImages;
+    }
+
+    batchSize = std::max(1, batchSize);
+    for (size_t begin = 0; begin < queryFeatures.size(); begin += batchSize) {
+        size_t end = std::min(begin + batchSize, queryFeatures.size());
+
+        Mat queries(static_cast<int>(end - begin), store.data.cols, CV_32F);
+        for (size_t i = begin; i < end; ++i) {
+            Mat destination = queries.row(static_cast<int>(i - begin));
+            if (static_cast<int>(queryFeatures[i].total()) != store.data.cols) {
+                std::cerr << "Query " << i << " does not match the database feature size." << std::endl;
+                destination.setTo(Scalar::all(0));
+                continue;
+            }
+            queryFeatures[i].reshape(1, 1).convertTo(destination, CV_32F);
+        }
+
+        std::vector<std::vector<std::pair<std::string, double>>> scores = rankBatchBySimilarity(queries, store, numResults, tileRows);
+        for (size_t i = begin; i < end; ++i) {
+            for (const auto& score : scores[i - begin]) {
+                topSimilarImages[i].push_back(score.first);
+            }
+        }
     }
 
     return topSimilarImages;
 }
 
-std::vector<std::string> retrivalSIFTHistogram(const Mat& queryImage, FeatureDatabase db, const Mat& querySift, const Mat& queryHistogram, const std::string& dataset, int numResults, std::string& path) {
-    std::vector<std::string> topSimilarImages;
+// Rows sharing a dominant bin tend to be similar, so grouping by it gives chunks whose centroids say
+// how promising the whole chunk is for a query
+ChunkIndex buildChunkIndex(const FeatureMatrix& store, int chunkRows) {
+    TRACE_SCOPE("chunk_index");
+    ChunkIndex index;
+    index.chunkRows = std::max(1, chunkRows);
+
+    int count = store.data.rows;
+    std::vector<int> dominant(count, 0);
+    for (int row = 0; row < count; ++row) {
+        Point maxLocation;
+        cv::minMaxLoc(store.data.row(row), nullptr, nullptr, nullptr, &maxLocation);
+        dominant[row] = maxLocation.x;
+    }
 
-    // Load database features
-    std::vector<std::pair<std::string, Mat>> siftFeatures = db.loadFeatures("sift_histogram", dataset, path);
-    std::vector<std::pair<std::string, Mat>> histogramFeatures = db.loadFeatures("histogram", dataset, path);
+    index.order.resize(count);
+    std::iota(index.order.begin(), index.order.end(), 0);
+    std::stable_sort(index.order.begin(), index.order.end(), [&](int a, int b) { return dominant[a] < dominant[b]; });
 
-    // Check if features are loaded
-    if (siftFeatures.empty() || histogramFeatures.empty()) {
+    int numChunks = (count + index.chunkRows - 1) / index.chunkRows;
+    index.centroids = Mat::zeros(numChunks, store.data.cols, CV_32F);
+    for (int i = 0; i < count; ++i) {
+        Mat centroid = index.centroids.row(i / index.chunkRows);
+        centroid += store.data.row(index.order[i]);
+    }
+    return index;
+}
+
+// Chunk index layout: "VIRC" | uint64 source size | int64 source mtime | int32 chunkRows | int32 rows | int32 cols
+//                     | int32 order[rows] | float32 centroids[chunks * cols]
+bool saveChunkIndex(const ChunkIndex& index, int cols, const std::string& filename, const SourceStamp& source) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file for writing: " << filename << std::endl;
+        return false;
+    }
+
+    int32_t header[3] = { index.chunkRows, static_cast<int32_t>(index.order.size()), cols };
+    file.write("VIRC", 4);
+    file.write(reinterpret_cast<const char*>(&source.size), sizeof(source.size));
+    file.write(reinterpret_cast<const char*>(&source.modified), sizeof(source.modified));
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(index.order.data()), index.order.size() * sizeof(int32_t));
+    for (int chunk = 0; chunk < index.centroids.rows; ++chunk) {
+        file.write(reinterpret_cast<const char*>(index.centroids.ptr<float>(chunk)), cols * sizeof(float));
+    }
+    return static_cast<bool>(file);
+}
+
+// Only an index built from the same XML store, with the same chunk size and shape, is accepted
+bool loadChunkIndex(const std::string& filename, const SourceStamp& source, int chunkRows, const FeatureMatrix& store, ChunkIndex& index) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    char magic[4];
+    SourceStamp stamp;
+    int32_t header[3] = { 0, 0, 0 };
+    file.read(magic, 4);
+    file.read(reinterpret_cast<char*>(&stamp.size), sizeof(stamp.size));
+    file.read(reinterpret_cast<char*>(&stamp.modified), sizeof(stamp.modified));
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!file || std::string(magic, 4) != "VIRC" || stamp != source || header[0] != std::max(1, chunkRows)
+        || header[1] != store.data.rows || header[2] != store.data.cols) {
+        return false;
+    }
+
+    index.chunkRows = header[0];
+    index.order.resize(header[1]);
+    file.read(reinterpret_cast<char*>(index.order.data()), index.order.size() * sizeof(int32_t));
+    int numChunks = (header[1] + index.chunkRows - 1) / index.chunkRows;
+    index.centroids.create(numChunks, header[2], CV_32F);
+    for (int chunk = 0; chunk < numChunks; ++chunk) {
+        file.read(reinterpret_cast<char*>(index.centroids.ptr<float>(chunk)), header[2] * sizeof(float));
+    }
+    return static_cast<bool>(file);
+}
+
+ChunkIndex loadOrBuildChunkIndex(FeatureDatabase& db, const FeatureMatrix& store, const std::string& featureType, const std::string& dataset, std::string& path, int chunkRows) {
+    std::string filename = db.chunkIndexFilename(featureType, dataset, path);
+    SourceStamp source = sourceStamp(db.featureFilename(featureType, dataset, path));
+
+    ChunkIndex index;
+    {
+        TRACE_SCOPE("chunk_index_load");
+        if (loadChunkIndex(filename, source, chunkRows, store, index)) {
+            return index;
+        }
+    }
+
+    index = buildChunkIndex(store, chunkRows);
+    saveChunkIndex(index, store.data.cols, filename, source);
+    return index;
+}
+
+AnytimeResult rankWithinDeadline(const Mat& queryHistogram, const FeatureMatrix& store, const ChunkIndex& index, int numResults, std::chrono::microseconds budget) {
+    return rankWithinDeadline(queryHistogram, store, index, numResults, std::chrono::steady_clock::now() + budget);
+}
+
+// Scan chunks from the most to the least promising centroid until the deadline passes. The most promising
+// chunk is always scored, so even an exhausted budget returns its best guess rather than nothing
+AnytimeResult rankWithinDeadline(const Mat& queryHistogram, const FeatureMatrix& store, const ChunkIndex& index, int numResults, std::chrono::steady_clock::time_point deadline) {
+    typedef std::pair<double, int> ScoredRow;
+
+    AnytimeResult answer;
+    answer.total = store.names.size();
+    if (store.data.empty() || numResults <= 0 || static_cast<int>(queryHistogram.total()) != store.data.cols) {
+        return answer;
+    }
+
+    Mat query;
+    queryHistogram.reshape(1, 1).convertTo(query, CV_32F);
+    CosineKernel kernel = selectCosineKernel(store.data.cols, CV_32F);
+
+    std::vector<std::pair<double, int>> chunks;
+    for (int chunk = 0; chunk < index.centroids.rows; ++chunk) {
+        chunks.push_back({ kernel(query.ptr(), index.centroids.ptr(chunk), store.data.cols), chunk });
+    }
+    std::sort(chunks.begin(), chunks.end(), std::greater<std::pair<double, int>>());
+
+    TRACE_SCOPE("score_anytime");
+    std::priority_queue<ScoredRow, std::vector<ScoredRow>, std::greater<ScoredRow>> heap;
+    for (const auto& chunk : chunks) {
+        if (answer.scored > 0 && std::chrono::steady_clock::now() >= deadline) {
+            answer.partial = true;
+            break;
+        }
+
+        int begin = chunk.second * index.chunkRows;
+        int end = std::min(begin + index.chunkRows, static_cast<int>(index.order.size()));
+        for (int i = begin; i < end; ++i) {
+            int row = index.order[i];
+            double score = kernel(query.ptr(), store.data.ptr(row), store.data.cols);
+            if (static_cast<int>(heap.size()) < numResults) {
+                heap.push({ score, row });
+            }
+            else if (score > heap.top().first) {
+                heap.pop();
+                heap.push({ score, row });
+            }
+        }
+        answer.scored += end - begin;
+    }
+    TRACE_COUNTER("rows_scanned", answer.scored);
+
+    answer.results.resize(heap.size());
+    for (int i = static_cast<int>(heap.size()) - 1; i >= 0; --i) {
+        answer.results[i] = { store.names[heap.top().second], heap.top().first };
+        heap.pop();
+    }
+    return answer;
+}
+
+std::vector<std::string> findTopSimilarImagesWithin(FeatureDatabase db, const Mat& queryHistogram, const std::string& featureType, const std::string& dataset, int numResults, std::string& path, double budgetMs, int chunkRows) {
+    std::vector<std::string> topSimilarImages;
+    if (rejectHashStore(featureType)) {
+        return topSimilarImages;
+    }
+
+    // The budget bounds scoring once the store and its index are resident; the reported latency covers the whole call
+    auto start = std::chrono::steady_clock::now();
+    FeatureMatrix store = packFeatures(db.loadFeatures(featureType, dataset, path));
+    if (store.data.empty()) {
         std::cerr << "No features loaded from the database." << std::endl;
         return topSimilarImages;
     }
 
+    ChunkIndex index = loadOrBuildChunkIndex(db, store, featureType, dataset, path, chunkRows);
+
+    auto resident = std::chrono::steady_clock::now();
+    AnytimeResult answer = rankWithinDeadline(queryHistogram, store, index, numResults, std::chrono::microseconds(static_cast<long long>(budgetMs * 1000)));
+
+    auto finished = std::chrono::steady_clock::now();
+    std::cout << (answer.partial ? "Partial result: " : "Complete result: ") << "scored " << answer.scored
+        << " of " << answer.total << " images in " << std::chrono::duration<double, std::milli>(finished - resident).count()
+        << " ms, " << std::chrono::duration<double, std::milli>(finished - start).count() << " ms including the load" << std::endl;
+    for (const auto& result : answer.results) {
+        topSimilarImages.push_back(result.first);
+    }
+    return topSimilarImages;
+}
+
+// Weighted fusion of the SIFT BoVW and color histogram scores over two in-memory stores
+std::vector<std::pair<std::string, double>> rankFusedBySimilarity(const Mat& querySift, const std::vector<std::pair<std::string, Mat>>& siftFeatures, const Mat& queryHistogram, const std::vector<std::pair<std::string, Mat>>& histogramFeatures, double siftWeight, int numResults) {
     std::vector<std::pair<std::string, double>> similarityScores;
 
     // Compute similarity scores for SIFT histograms
     std::map<std::string, double> siftScores;
-    for (const auto& dbFeature : siftFeatures) {
-        double score = computeCosineSimilarity(querySift, dbFeature.second);
-        siftScores[dbFeature.first] = score;
-    }
-
-    // Compute similarity scores for color histograms
     std::map<std::string, double> histogramScores;
-    for (const auto& dbFeature : histogramFeatures) {
-        double score = computeCosineSimilarity(queryHistogram, dbFeature.second);
-        histogramScores[dbFeature.first] = score;
+    {
+        TRACE_SCOPE("score");
+        CosineKernel siftKernel;
+        Mat siftQuery = prepareQueryForStore(querySift, siftFeatures, siftKernel);
+        for (const auto& dbFeature : siftFeatures) {
+            double score = scoreWithKernel(siftKernel, siftQuery, dbFeature.second);
+            siftScores[dbFeature.first] = score;
+        }
+
+        // Compute similarity scores for color histograms
+        CosineKernel histogramKernel;
+        Mat histogramQuery = prepareQueryForStore(queryHistogram, histogramFeatures, histogramKernel);
+        for (const auto& dbFeature : histogramFeatures) {
+            double score = scoreWithKernel(histogramKernel, histogramQuery, dbFeature.second);
+            histogramScores[dbFeature.first] = score;
+        }
+        TRACE_COUNTER("rows_scanned", siftFeatures.size() + histogramFeatures.size());
     }
 
     // Combine similarity scores
     for (const auto& siftScore : siftScores) {
-        double combinedScore = 0.5 * siftScore.second + 0.5 * histogramScores[siftScore.first]; // equal weighting
+        double combinedScore = siftWeight * siftScore.second + (1.0 - siftWeight) * histogramScores[siftScore.first];
         similarityScores.push_back({ siftScore.first, combinedScore });
     }
 
     // Sort similarity scores
-    if (!similarityScores.empty()) {
+    {
+        TRACE_SCOPE("sort");
         std::sort(similarityScores.begin(), similarityScores.end(), compareByScore);
     }
-    else {
+
+    if (static_cast<int>(similarityScores.size()) > numResults) {
+        similarityScores.resize(std::max(numResults, 0));
+    }
+    return similarityScores;
+}
+
+std::vector<std::string> retrivalSIFTHistogram(const Mat& queryImage, FeatureDatabase db, const Mat& querySift, const Mat& queryHistogram, const std::string& dataset, int numResults, std::string& path, double siftWeight) {
+    std::vector<std::string> topSimilarImages;
+
+    // Load database features
+    std::vector<std::pair<std::string, Mat>> siftFeatures = db.loadFeatures("sift_histogram", dataset, path);
+    std::vector<std::pair<std::string, Mat>> histogramFeatures = db.loadFeatures("histogram", dataset, path);
+
+    // Check if features are loaded
+    if (siftFeatures.empty() || histogramFeatures.empty()) {
+        std::cerr << "No features loaded from the database." << std::endl;
+        return topSimilarImages;
+    }
+
+    std::vector<std::pair<std::string, double>> similarityScores = rankFusedBySimilarity(querySift, siftFeatures, queryHistogram, histogramFeatures, siftWeight, numResults);
+    if (similarityScores.empty()) {
         std::cerr << "No matching features found in the database." << std::endl;
         return topSimilarImages;
     }
 
     // Retrieve top N results
-    for (int i = 0; i < std::min(numResults, static_cast<int>(similarityScores.size())); ++i) {
-        topSimilarImages.push_back(similarityScores[i].first);
+    for (const auto& score : similarityScores) {
+        topSimilarImages.push_back(score.first);
     }
 
     return topSimilarImages;
@@ -119,6 +736,7 @@ std::vector<std::string> retrivalSIFTHistogram(const Mat& queryImage, FeatureDat
 
 // Function to display query image and retrieved images in separate windows
 void displayImagesInSeparateWindows(const std::string& queryImagePath, const std::vector<std::string>& imagePaths) {
+    TRACE_SCOPE("display");
     // Create windows to display query image and similar images
     cv::namedWindow("Query Image", cv::WINDOW_NORMAL);
     cv::namedWindow("Similar Images", cv::WINDOW_NORMAL);
@@ -139,15 +757,24 @@ void displayImagesInSeparateWindows(const std::string& queryImagePath, const std
     int numCols = std::ceil(std::sqrt(numImages));
     int numRows = std::ceil(static_cast<double>(numImages) / numCols);
 
+    // Decode every retrieved image once; the same Mats are used for sizing and pasting
+    std::vector<cv::Mat> images;
+    images.reserve(imagePaths.size());
+    for (const auto& imagePath : imagePaths) {
+        cv::Mat image = readImageOrKeyframe(imagePath);
+        if (image.empty()) {
+            std::cerr << "Failed to read image: " << imagePath << std::endl;
+            continue;
+        }
+        images.push_back(image);
+    }
+
     // Calculate the size of the grid cells (maximum width and height)
     int maxWidth = 0;
     int maxHeight = 0;
-    for (const auto& imagePath : imagePaths) {
-        cv::Mat image = cv::imread(imagePath, cv::IMREAD_COLOR);
-        if (!image.empty()) {
-            maxWidth = std::max(maxWidth, image.cols);
-            maxHeight = std::max(maxHeight, image.rows);
-        }
+    for (const auto& image : images) {
+        maxWidth = std::max(maxWidth, image.cols);
+        maxHeight = std::max(maxHeight, image.rows);
     }
 
     // Include margins in the cell size
@@ -167,13 +794,7 @@ void displayImagesInSeparateWindows(const std::string& queryImagePath, const std
 
     // Insert each similar image into the grid
     int index = 0;
-    for (const auto& imagePath : imagePaths) {
-        cv::Mat image = cv::imread(imagePath, cv::IMREAD_COLOR);
-        if (image.empty()) {
-            std::cerr << "Failed to read image: " << imagePath << std::endl;
-            continue;
-        }
-
+    for (const auto& image : images) {
         int row = index / numCols;
         int col = index % numCols;
         insertImage(image, row, col);
@@ -184,4 +805,65 @@ void displayImagesInSeparateWindows(const std::string& queryImagePath, const std
     // Display the grid of similar images in the window
     cv::imshow("Similar Images", canvas);
     cv::waitKey(0);
+}
+
+// Headless rendering: build the result montage from cached thumbnails and write it to a file
+bool renderResultMontage(const Mat& queryImage, const std::vector<std::string>& imagePaths, const std::unordered_map<std::string, std::vector<uchar>>& thumbnails, int thumbnailSize, const std::string& outputFile) {
+    TRACE_SCOPE("render");
+    int margin = 5; // Spacing between images (pixels)
+    int cellSize = thumbnailSize + 2 * margin;
+
+    // Query thumbnail on the first row, results in a grid below it
+    int numImages = imagePaths.size();
+    int numCols = std::max(1, static_cast<int>(std::ceil(std::sqrt(numImages))));
+    int numRows = (numImages + numCols - 1) / numCols;
+
+    cv::Mat canvas = cv::Mat::zeros((numRows + 1) * cellSize, numCols * cellSize, CV_8UC3);
+
+    auto insertThumbnail = [&](const cv::Mat& thumbnail, int row, int col) {
+        cv::Rect roi(col * cellSize + margin, row * cellSize + margin, thumbnail.cols, thumbnail.rows);
+        thumbnail.copyTo(canvas(roi));
+        };
+
+    // The query is already decoded for feature extraction, so it only needs resizing
+    cv::Mat queryThumbnail = fitThumbnail(queryImage, thumbnailSize);
+    if (!queryThumbnail.empty()) {
+        insertThumbnail(queryThumbnail, 0, 0);
+    }
+
+    int index = 0;
+    for (const auto& imagePath : imagePaths) {
+        cv::Mat thumbnail;
+        auto cached = thumbnails.find(imagePath);
+        if (cached != thumbnails.end()) {
+            thumbnail = cv::imdecode(cached->second, cv::IMREAD_COLOR);
+        }
+        else {
+            // Not in the cache (e.g. extracted before thumbnails existed): fall back to a reduced decode
+            std::cerr << "Thumbnail not cached: " << imagePath << std::endl;
+            cv::Mat reduced = cv::imread(imagePath, cv::IMREAD_REDUCED_COLOR_4);
+            if (reduced.empty()) {
+                reduced = readImageOrKeyframe(imagePath);
+            }
+            if (!reduced.empty()) {
+                thumbnail = fitThumbnail(reduced, thumbnailSize);
+            }
+        }
+
+        if (thumbnail.empty() || thumbnail.cols != thumbnailSize || thumbnail.rows != thumbnailSize) {
+            std::cerr << "Failed to render thumbnail: " << imagePath << std::endl;
+            ++index;
+            continue;
+        }
+
+        insertThumbnail(thumbnail, 1 + index / numCols, index % numCols);
+        ++index;
+    }
+
+    if (!cv::imwrite(outputFile, canvas)) {
+        std::cerr << "Failed to write montage: " << outputFile << std::endl;
+        return false;
+    }
+    std::cout << "Result montage saved to " << outputFile << std::endl;
+    return true;
 }
\ No newline at end of file
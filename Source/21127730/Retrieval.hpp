@@ -3,10 +3,45 @@
 #include "Codebook.hpp"
 #include "Processing.hpp"
 #include "FeatureExtractor.hpp"
+#include "SimilarityKernels.hpp"
 #include <opencv2/opencv.hpp>
 #include <filesystem>
 #include <iostream>
+#include <chrono>
 
+// Chunks of store rows grouped by dominant bin, with one centroid per chunk to order the scan
+struct ChunkIndex {
+    std::vector<int> order;
+    Mat centroids;
+    int chunkRows = 0;
+};
+
+// Best-so-far answer of a deadline-bounded scan
+struct AnytimeResult {
+    std::vector<std::pair<std::string, double>> results;
+    bool partial = false;
+    size_t scored = 0;
+    size_t total = 0;
+};
+
+double computeCosineSimilarity(const Mat& hist1, const Mat& hist2);
+double scoreWithKernel(CosineKernel kernel, const Mat& query, const Mat& feature);
+Mat prepareQueryForStore(const Mat& query, const std::vector<std::pair<std::string, Mat>>& databaseFeatures, CosineKernel& kernel);
+std::vector<std::pair<std::string, double>> rankBySimilarity(const Mat& queryHistogram, const std::vector<std::pair<std::string, Mat>>& databaseFeatures, int numResults);
+std::vector<std::pair<std::string, double>> rankSparseBySimilarity(const Mat& queryHistogram, const SparseFeatureStore& store, int numResults, double sparseDensity);
+std::vector<std::pair<std::string, double>> rankChunkedBySimilarity(const Mat& queryHistogram, FeatureDatabase& db, const std::string& featureType, const std::string& dataset, int numResults, std::string& path, size_t chunkBytes);
+std::vector<std::pair<std::string, double>> rankStreamedBySimilarity(const Mat& queryHistogram, const std::string& rowStoreFile, int numResults, size_t chunkBytes);
 std::vector<std::string> findTopSimilarImages(const Mat& query_image, FeatureDatabase db, const Mat& queryHistogram, const std::string& featureType, const std::string& dataset, int numResults, std::string& path);
-std::vector<std::string> retrivalSIFTHistogram(const Mat& query_image, FeatureDatabase db, const Mat& query_sift, const Mat& query_histogram, const std::string& dataset, int numResults, std::string& path);
-void displayImagesInSeparateWindows(const std::string& queryImagePath, const std::vector<std::string>& imagePaths);
\ No newline at end of file
+std::vector<std::vector<std::pair<std::string, double>>> rankBatchBySimilarity(const Mat& queries, const FeatureMatrix& store, int numResults, int tileRows = 256);
+std::vector<std::vector<std::string>> findTopSimilarImagesBatch(const std::vector<Mat>& queryFeatures, FeatureDatabase db, const std::string& featureType, const std::string& dataset, int numResults, std::string& path, int batchSize = 64, int tileRows = 256);
+ChunkIndex buildChunkIndex(const FeatureMatrix& store, int chunkRows);
+bool saveChunkIndex(const ChunkIndex& index, int cols, const std::string& filename, const SourceStamp& source);
+bool loadChunkIndex(const std::string& filename, const SourceStamp& source, int chunkRows, const FeatureMatrix& store, ChunkIndex& index);
+ChunkIndex loadOrBuildChunkIndex(FeatureDatabase& db, const FeatureMatrix& store, const std::string& featureType, const std::string& dataset, std::string& path, int chunkRows);
+AnytimeResult rankWithinDeadline(const Mat& queryHistogram, const FeatureMatrix& store, const ChunkIndex& index, int numResults, std::chrono::steady_clock::time_point deadline);
+AnytimeResult rankWithinDeadline(const Mat& queryHistogram, const FeatureMatrix& store, const ChunkIndex& index, int numResults, std::chrono::microseconds budget);
+std::vector<std::string> findTopSimilarImagesWithin(FeatureDatabase db, const Mat& queryHistogram, const std::string& featureType, const std::string& dataset, int numResults, std::string& path, double budgetMs, int chunkRows = 1024);
+std::vector<std::pair<std::string, double>> rankFusedBySimilarity(const Mat& querySift, const std::vector<std::pair<std::string, Mat>>& siftFeatures, const Mat& queryHistogram, const std::vector<std::pair<std::string, Mat>>& histogramFeatures, double siftWeight, int numResults);
+std::vector<std::string> retrivalSIFTHistogram(const Mat& query_image, FeatureDatabase db, const Mat& query_sift, const Mat& query_histogram, const std::string& dataset, int numResults, std::string& path, double siftWeight = 0.5);
+void displayImagesInSeparateWindows(const std::string& queryImagePath, const std::vector<std::string>& imagePaths);
+bool renderResultMontage(const Mat& queryImage, const std::vector<std::string>& imagePaths, const std::unordered_map<std::string, std::vector<uchar>>& thumbnails, int thumbnailSize, const std::string& outputFile);
\ No newline at end of file
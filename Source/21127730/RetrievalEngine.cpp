@@ -0,0 +1,193 @@
+#include "RetrievalEngine.hpp"
+#include "Processing.hpp"
+#include "Retrieval.hpp"
+
+ExtractorPool::Lease ExtractorPool::acquire(const std::string& featureType) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& idle = idle_[featureType];
+        if (!idle.empty()) {
+            std::unique_ptr<FeatureExtractorInterface> extractor = std::move(idle.back());
+            idle.pop_back();
+            return Lease(*this, featureType, std::move(extractor));
+        }
+    }
+    // Built outside the lock; throws for unknown feature types like the factory itself
+    return Lease(*this, featureType, FeatureFactory::createFeature(featureType));
+}
+
+void ExtractorPool::release(const std::string& featureType, std::unique_ptr<FeatureExtractorInterface> extractor) {
+    if (!extractor) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_[featureType].push_back(std::move(extractor));
+}
+
+RetrievalEngine::RetrievalEngine(const EngineOptions& options) : options_(options) {
+}
+
+bool RetrievalEngine::load() {
+    TRACE_SCOPE("engine_load");
+    FeatureDatabase db;
+
+    std::set<std::string> featureTypes;
+    for (const auto& featureType : options_.featureTypes) {
+        if (featureType == "sift_histogram") {
+            featureTypes.insert("sift");
+            featureTypes.insert("histogram");
+        }
+        else {
+            featureTypes.insert(featureType);
+        }
+    }
+    if (options_.hashShortcut) {
+        featureTypes.insert("phash");
+    }
+
+    bool ok = true;
+    for (const auto& featureType : featureTypes) {
+        if (featureType == "phash") {
+            hashIndex_.reset(new MultiIndexHash());
+            loadHashIndex(*hashIndex_, db, options_.dataset, options_.databasePath);
+            hashMemory_ = MemoryHandle("index/phash_" + options_.dataset, hashIndex_->memoryBytes(), hashIndex_->size());
+            if (hashIndex_->size() == 0) {
+                std::cerr << "No hashes loaded for the near-duplicate index." << std::endl;
+                hashIndex_.reset();
+                ok = false;
+            }
+            continue;
+        }
+
+        Store store;
+        std::string data = featureType;
+        if (options_.localFeatures.count(featureType)) {
+            Mat centers = readCodebookFromFile(options_.databasePath + featureType + "_codebook_" + options_.dataset + ".xml");
+            // Converted once here, so CalculateQueryHistograms never rewrites the shared codebook while queries run
+            centers.convertTo(store.centers, CV_32F);
+            data = featureType + "_histogram";
+        }
+
+        store.matrix = packFeatures(db.loadFeatures(data, options_.dataset, options_.databasePath));
+        if (store.matrix.data.empty() || (options_.localFeatures.count(featureType) && store.centers.empty())) {
+            std::cerr << "Failed to load the " << featureType << " store." << std::endl;
+            ok = false;
+            continue;
+        }
+
+        store.rows.reserve(store.matrix.names.size());
+        for (size_t i = 0; i < store.matrix.names.size(); ++i) {
+            store.rows.emplace_back(store.matrix.names[i], store.matrix.data.row(static_cast<int>(i)));
+        }
+        store.memory = MemoryHandle("engine/" + featureType, matBytes(store.matrix.data) + store.matrix.norms.capacity() * sizeof(double) + matBytes(store.centers), store.rows.size());
+        stores_[featureType] = std::move(store);
+    }
+    return ok;
+}
+
+bool RetrievalEngine::hasFeature(const std::string& featureType) const {
+    if (featureType == "phash") {
+        return hashIndex_ != nullptr;
+    }
+    if (featureType == "sift_histogram") {
+        return stores_.count("sift") && stores_.count("histogram");
+    }
+    return stores_.count(featureType) > 0;
+}
+
+Mat RetrievalEngine::extract(const Mat& image, const std::string& featureType) const {
+    TRACE_SCOPE("extract");
+    Mat extractedFeatures;
+    try {
+        ExtractorPool::Lease extractor = pool_.acquire(featureType);
+        extractedFeatures = extractor->extractFeature(image);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error extracting features: " << e.what() << std::endl;
+    }
+    return extractedFeatures;
+}
+
+Mat RetrievalEngine::queryFeature(const Mat& image, const std::string& featureType) const {
+    Mat feature = extract(image, featureType);
+    const Store& store = stores_.at(featureType);
+    if (!store.centers.empty() && !feature.empty()) {
+        Mat centers = store.centers;
+        feature = CalculateQueryHistograms(feature, centers);
+    }
+    return feature;
+}
+
+std::vector<EngineResult> RetrievalEngine::search(const Mat& image, const std::string& featureType, int numResults) const {
+    std::vector<EngineResult> results;
+    if (image.empty()) {
+        std::cerr << "Empty query image" << std::endl;
+        return results;
+    }
+    if (!hasFeature(featureType)) {
+        std::cerr << "Feature type not loaded: " << featureType << std::endl;
+        return results;
+    }
+
+    // Hash hits are scored as the fraction of matching bits, so they sort with the other scores
+    if (hashIndex_ && (featureType == "phash" || options_.hashShortcut)) {
+        for (const auto& hit : findNearDuplicates(image, *hashIndex_, options_.hashRadius, numResults)) {
+            results.push_back({ hit.first, 1.0 - hit.second / 64.0 });
+        }
+        if (!results.empty() || featureType == "phash") {
+            return results;
+        }
+    }
+
+    std::vector<std::pair<std::string, double>> scores;
+    if (featureType == "sift_histogram") {
+        Mat querySift = queryFeature(image, "sift");
+        Mat queryHistogram = queryFeature(image, "histogram");
+        scores = rankFusedBySimilarity(querySift, stores_.at("sift").rows, queryHistogram, stores_.at("histogram").rows, options_.siftWeight, numResults);
+    }
+    else {
+        Mat query = queryFeature(image, featureType);
+        if (query.empty()) {
+            std::cerr << "Feature extraction failed for the query image" << std::endl;
+            return results;
+        }
+        scores = rankBySimilarity(query, stores_.at(featureType).rows, numResults);
+    }
+
+    results.reserve(scores.size());
+    for (const auto& score : scores) {
+        results.push_back({ score.first, score.second });
+    }
+    return results;
+}
+
+std::vector<EngineResult> RetrievalEngine::search(const uchar* encoded, size_t size, const std::string& featureType, int numResults) const {
+    Mat image;
+    {
+        TRACE_SCOPE("decode");
+        image = cv::imdecode(Mat(1, static_cast<int>(size), CV_8U, const_cast<uchar*>(encoded)), cv::IMREAD_COLOR);
+    }
+    if (image.empty()) {
+        std::cerr << "Failed to decode query image" << std::endl;
+        return std::vector<EngineResult>();
+    }
+    return search(image, featureType, numResults);
+}
+
+std::vector<EngineResult> RetrievalEngine::search(const std::vector<uchar>& encoded, const std::string& featureType, int numResults) const {
+    return search(encoded.data(), encoded.size(), featureType, numResults);
+}
+
+EngineOptions readEngineOptions(std::unordered_map<std::string, std::unordered_map<std::string, std::string>>& config, const std::string& dataset) {
+    EngineOptions options;
+    options.dataset = dataset;
+    options.databasePath = getConfigValue(config, "PATH", "path", "");
+    for (const auto& feature : split(getConfigValue(config, "FEATURES", "local", ""), ',')) {
+        options.localFeatures.insert(feature);
+    }
+    options.featureTypes = split(getConfigValue(config, "ENGINE", "features", "histogram"), ',');
+    options.siftWeight = stod(getConfigValue(config, "RETRIEVE", "sift_weight", "0.5"));
+    options.hashShortcut = getConfigValue(config, "PHASH", "shortcut", "0") == "1";
+    options.hashRadius = stoi(getConfigValue(config, "PHASH", "radius", "4"));
+    return options;
+}
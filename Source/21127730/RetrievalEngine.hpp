@@ -0,0 +1,90 @@
+#pragma once
+#include "Database.hpp"
+#include "Codebook.hpp"
+#include "FeatureExtractor.hpp"
+#include "HashIndex.hpp"
+#include <opencv2/opencv.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+struct EngineOptions {
+    std::string databasePath;
+    std::string dataset;
+    std::vector<std::string> featureTypes;  // Stores to load; "phash" loads the hash index, "sift_histogram" both its stores
+    std::set<std::string> localFeatures;    // Matched through their codebook and BoVW histograms
+    double siftWeight = 0.5;
+    int hashRadius = 4;                     // Hamming radius of near-duplicate lookups, in bits
+    bool hashShortcut = false;              // Answer from the hash index first when it has hits
+};
+
+struct EngineResult {
+    std::string id;
+    double score;
+};
+
+// Keeps idle extractors per feature type so detectors are built once and each is used by one thread at a time
+class ExtractorPool {
+public:
+    class Lease {
+    public:
+        Lease(ExtractorPool& pool, const std::string& featureType, std::unique_ptr<FeatureExtractorInterface> extractor)
+            : pool_(pool), featureType_(featureType), extractor_(std::move(extractor)) {}
+        ~Lease() { pool_.release(featureType_, std::move(extractor_)); }
+
+        FeatureExtractorInterface* operator->() const { return extractor_.get(); }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+    private:
+        ExtractorPool& pool_;
+        std::string featureType_;
+        std::unique_ptr<FeatureExtractorInterface> extractor_;
+    };
+
+    Lease acquire(const std::string& featureType);
+
+private:
+    void release(const std::string& featureType, std::unique_ptr<FeatureExtractorInterface> extractor);
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::vector<std::unique_ptr<FeatureExtractorInterface>>> idle_;
+};
+
+// Library entry point to retrieval. load() reads the stores, codebooks and hash index once; after that
+// the engine is read-only and search() may be called from any number of threads at the same time.
+// Queries come in as a decoded Mat or as encoded bytes and never touch the disk.
+class RetrievalEngine {
+public:
+    explicit RetrievalEngine(const EngineOptions& options);
+
+    bool load();
+    bool hasFeature(const std::string& featureType) const;
+
+    std::vector<EngineResult> search(const Mat& image, const std::string& featureType, int numResults) const;
+    std::vector<EngineResult> search(const uchar* encoded, size_t size, const std::string& featureType, int numResults) const;
+    std::vector<EngineResult> search(const std::vector<uchar>& encoded, const std::string& featureType, int numResults) const;
+
+private:
+    struct Store {
+        FeatureMatrix matrix;
+        std::vector<std::pair<std::string, Mat>> rows;  // Row views into matrix.data, no copies
+        Mat centers;
+        MemoryHandle memory;
+    };
+
+    Mat extract(const Mat& image, const std::string& featureType) const;
+    Mat queryFeature(const Mat& image, const std::string& featureType) const;
+
+    EngineOptions options_;
+    std::map<std::string, Store> stores_;
+    std::unique_ptr<MultiIndexHash> hashIndex_;
+    MemoryHandle hashMemory_;
+    mutable ExtractorPool pool_;
+};
+
+EngineOptions readEngineOptions(std::unordered_map<std::string, std::unordered_map<std::string, std::string>>& config, const std::string& dataset);
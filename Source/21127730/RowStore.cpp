@@ -0,0 +1,244 @@
+#include "RowStore.hpp"
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+const size_t HEADER_SIZE = 4 + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(int64_t);
+
+}
+
+SourceStamp sourceStamp(const std::string& filename) {
+    SourceStamp stamp;
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(filename, error);
+    if (error) {
+        return stamp;
+    }
+    auto modified = std::filesystem::last_write_time(filename, error);
+    if (error) {
+        return stamp;
+    }
+    stamp.size = size;
+    stamp.modified = static_cast<int64_t>(modified.time_since_epoch().count());
+    return stamp;
+}
+
+// Written to a temporary file like the feature stores, so a partial pack never replaces a finished row store
+RowStoreWriter::RowStoreWriter(const std::string& filename, const SourceStamp& source) : file_(filename + ".tmp", std::ios::binary), filename_(filename), source_(source) {
+    if (!file_.is_open()) {
+        std::cerr << "Failed to open file for writing: " << temporaryFilename() << std::endl;
+        return;
+    }
+
+    // The header is rewritten with the final dimensions and row count on close
+    uint64_t rows = 0;
+    file_.write("VIRS", 4);
+    file_.write(reinterpret_cast<const char*>(&dims_), sizeof(dims_));
+    file_.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+    file_.write(reinterpret_cast<const char*>(&source_.size), sizeof(source_.size));
+    file_.write(reinterpret_cast<const char*>(&source_.modified), sizeof(source_.modified));
+}
+
+RowStoreWriter::~RowStoreWriter() {
+    if (file_.is_open()) {
+        file_.close();
+        std::error_code error;
+        std::filesystem::remove(temporaryFilename(), error);
+    }
+}
+
+bool RowStoreWriter::write(const std::string& name, const cv::Mat& feature) {
+    if (!file_.is_open() || feature.empty() || feature.channels() != 1) {
+        return false;
+    }
+    if (dims_ == 0) {
+        dims_ = static_cast<uint32_t>(feature.total());
+    }
+    if (feature.total() != dims_) {
+        std::cerr << "Skipping feature with mismatched size: " << name << std::endl;
+        return false;
+    }
+
+    cv::Mat row;
+    feature.reshape(1, 1).convertTo(row, CV_32F);
+    file_.write(reinterpret_cast<const char*>(row.ptr<float>(0)), dims_ * sizeof(float));
+    names_.push_back(name);
+    return true;
+}
+
+bool RowStoreWriter::close() {
+    if (!file_.is_open()) {
+        return false;
+    }
+
+    // Name table: offsets first so a single name can be read with two seeks
+    uint64_t offset = 0;
+    for (const auto& name : names_) {
+        file_.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        offset += name.size();
+    }
+    file_.write(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    for (const auto& name : names_) {
+        file_.write(name.data(), name.size());
+    }
+
+    uint64_t rows = names_.size();
+    file_.seekp(4);
+    file_.write(reinterpret_cast<const char*>(&dims_), sizeof(dims_));
+    file_.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+
+    bool ok = static_cast<bool>(file_);
+    file_.close();
+    names_.clear();
+    std::error_code error;
+    if (ok) {
+        std::filesystem::rename(temporaryFilename(), filename_, error);
+    }
+    if (!ok || error) {
+        std::cerr << "Failed to write row store: " << filename_ << std::endl;
+        std::filesystem::remove(temporaryFilename(), error);
+        return false;
+    }
+    return true;
+}
+
+RowStoreReader::RowStoreReader(const std::string& filename) : buffer_(1 << 20) {
+    // Chunks are read with large sequential requests; the stream buffer only smooths the header and name reads
+    file_.rdbuf()->pubsetbuf(buffer_.data(), buffer_.size());
+    file_.open(filename, std::ios::binary);
+    if (!file_.is_open()) {
+        return;
+    }
+    std::error_code error;
+    fileSize_ = std::filesystem::file_size(filename, error);
+
+    char magic[4];
+    file_.read(magic, 4);
+    file_.read(reinterpret_cast<char*>(&dims_), sizeof(dims_));
+    file_.read(reinterpret_cast<char*>(&rows_), sizeof(rows_));
+    file_.read(reinterpret_cast<char*>(&source_.size), sizeof(source_.size));
+    file_.read(reinterpret_cast<char*>(&source_.modified), sizeof(source_.modified));
+    valid_ = file_ && std::string(magic, 4) == "VIRS" && dims_ > 0;
+    if (!valid_) {
+        std::cerr << "Invalid format in the row store: " << filename << std::endl;
+    }
+}
+
+size_t RowStoreReader::read(float* dst, size_t maxRows) {
+    size_t count = static_cast<size_t>(std::min<uint64_t>(maxRows, rows_ - nextRow_));
+    if (!valid_ || failed_ || count == 0) {
+        return 0;
+    }
+
+    // A short read means the file is shorter than its header claims; the stream position is no longer
+    // on a row boundary, so the whole rows that did arrive are the last ones handed out
+    file_.read(reinterpret_cast<char*>(dst), count * dims_ * sizeof(float));
+    size_t complete = static_cast<size_t>(file_.gcount()) / (dims_ * sizeof(float));
+    if (complete < count) {
+        std::cerr << "Truncated row store after row " << nextRow_ + complete << std::endl;
+        failed_ = true;
+        nextRow_ = rows_;
+        return complete;
+    }
+    nextRow_ += count;
+    return count;
+}
+
+bool RowStoreReader::readRow(uint64_t row, float* dst) {
+    if (!valid_ || row >= rows_) {
+        return false;
+    }
+
+    file_.clear();
+    file_.seekg(HEADER_SIZE + row * dims_ * sizeof(float));
+    file_.read(reinterpret_cast<char*>(dst), dims_ * sizeof(float));
+    nextRow_ = rows_;
+    return static_cast<bool>(file_);
+}
+
+void RowStoreReader::seek(uint64_t row) {
+    if (!valid_) {
+        return;
+    }
+
+    nextRow_ = std::min(row, rows_);
+    file_.clear();
+    file_.seekg(HEADER_SIZE + nextRow_ * dims_ * sizeof(float));
+}
+
+// Header fields are checked against the file size before anything is sized from them, without overflowing
+uint64_t RowStoreReader::nameTableStart() const {
+    uint64_t rowBytes = static_cast<uint64_t>(dims_) * sizeof(float);
+    if (!valid_ || fileSize_ < HEADER_SIZE || rows_ > (fileSize_ - HEADER_SIZE) / rowBytes) {
+        return 0;
+    }
+    uint64_t start = HEADER_SIZE + rows_ * rowBytes;
+    if ((fileSize_ - start) / sizeof(uint64_t) < rows_ + 1) {
+        return 0;
+    }
+    return start;
+}
+
+// The whole name table in row order, without touching the rows themselves
+std::vector<std::string> RowStoreReader::names() {
+    std::vector<std::string> result;
+    uint64_t tableStart = nameTableStart();
+    if (tableStart == 0) {
+        std::cerr << "Truncated name table in the row store." << std::endl;
+        return result;
+    }
+    uint64_t bytesStart = tableStart + (rows_ + 1) * sizeof(uint64_t);
+
+    std::vector<uint64_t> offsets(static_cast<size_t>(rows_ + 1));
+    file_.clear();
+    file_.seekg(tableStart);
+    file_.read(reinterpret_cast<char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    nextRow_ = rows_;
+    if (!file_ || offsets.back() > fileSize_ - bytesStart) {
+        std::cerr << "Truncated name table in the row store." << std::endl;
+        return result;
+    }
+    for (uint64_t row = 0; row < rows_; ++row) {
+        if (offsets[row] > offsets[row + 1]) {
+            std::cerr << "Invalid name table in the row store." << std::endl;
+            return result;
+        }
+    }
+
+    std::string bytes(static_cast<size_t>(offsets.back()), '\0');
+    file_.read(&bytes[0], bytes.size());
+    if (!file_) {
+        std::cerr << "Truncated name table in the row store." << std::endl;
+        return result;
+    }
+
+    result.reserve(static_cast<size_t>(rows_));
+    for (uint64_t row = 0; row < rows_; ++row) {
+        result.push_back(bytes.substr(static_cast<size_t>(offsets[row]), static_cast<size_t>(offsets[row + 1] - offsets[row])));
+    }
+    return result;
+}
+
+std::string RowStoreReader::nameAt(uint64_t row) {
+    uint64_t tableStart = nameTableStart();
+    if (tableStart == 0 || row >= rows_) {
+        return "";
+    }
+    uint64_t bytesStart = tableStart + (rows_ + 1) * sizeof(uint64_t);
+
+    uint64_t offsets[2];
+    file_.clear();
+    file_.seekg(tableStart + row * sizeof(uint64_t));
+    file_.read(reinterpret_cast<char*>(offsets), sizeof(offsets));
+    // The sequential position is lost to the seeks, so callers finish scanning before resolving names
+    nextRow_ = rows_;
+    if (!file_ || offsets[0] > offsets[1] || offsets[1] > fileSize_ - bytesStart) {
+        return "";
+    }
+
+    std::string name(static_cast<size_t>(offsets[1] - offsets[0]), '\0');
+    file_.seekg(bytesStart + offsets[0]);
+    file_.read(&name[0], name.size());
+    return file_ ? name : "";
+}
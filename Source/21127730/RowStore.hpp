@@ -0,0 +1,79 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Size and modification time of the file a derived file was built from; a mismatch means it is stale
+struct SourceStamp {
+    uint64_t size = 0;
+    int64_t modified = 0;
+
+    bool operator==(const SourceStamp& other) const { return size == other.size && modified == other.modified; }
+    bool operator!=(const SourceStamp& other) const { return !(*this == other); }
+};
+
+SourceStamp sourceStamp(const std::string& filename);
+
+// Flat copy of a feature store that can be scanned front to back in fixed-size chunks without parsing.
+// Layout: "VIRS" | uint32 dims | uint64 rows | uint64 source size | int64 source mtime
+//         | rows * dims float32 | uint64 name offsets[rows + 1] | name bytes
+class RowStoreWriter {
+public:
+    RowStoreWriter(const std::string& filename, const SourceStamp& source);
+    ~RowStoreWriter();
+
+    bool isOpen() const { return file_.is_open(); }
+    bool write(const std::string& name, const cv::Mat& feature);
+    // Finishes the temporary file and renames it over the row store; a writer destroyed without close()
+    // discards what it wrote
+    bool close();
+
+    RowStoreWriter(const RowStoreWriter&) = delete;
+    RowStoreWriter& operator=(const RowStoreWriter&) = delete;
+
+private:
+    std::string temporaryFilename() const { return filename_ + ".tmp"; }
+
+    std::ofstream file_;
+    std::string filename_;
+    SourceStamp source_;
+    uint32_t dims_ = 0;
+    std::vector<std::string> names_;
+};
+
+class RowStoreReader {
+public:
+    explicit RowStoreReader(const std::string& filename);
+
+    bool isOpen() const { return valid_; }
+    int dims() const { return static_cast<int>(dims_); }
+    uint64_t rows() const { return rows_; }
+    const SourceStamp& source() const { return source_; }
+    // True once a read came up short of the row count in the header
+    bool failed() const { return failed_; }
+
+    // Reads up to maxRows whole rows into dst (maxRows * dims floats) and returns how many were read
+    size_t read(float* dst, size_t maxRows);
+    std::string nameAt(uint64_t row);
+    // Random access for scoring a few known rows; like nameAt it ends any sequential scan
+    bool readRow(uint64_t row, float* dst);
+    // Moves the sequential scan to start at row
+    void seek(uint64_t row);
+    std::vector<std::string> names();
+
+private:
+    // Offset of the name table, or 0 when the rows the header claims do not fit in the file
+    uint64_t nameTableStart() const;
+
+    std::ifstream file_;
+    std::vector<char> buffer_;
+    uint64_t fileSize_ = 0;
+    bool valid_ = false;
+    bool failed_ = false;
+    SourceStamp source_;
+    uint32_t dims_ = 0;
+    uint64_t rows_ = 0;
+    uint64_t nextRow_ = 0;
+};
@@ -0,0 +1,128 @@
+#include "SimilarityKernels.hpp"
+
+namespace {
+
+template <int Dims, typename T>
+double fixedKernel(const void* a, const void* b, int) {
+    return cosineFixed<Dims, T>(static_cast<const T*>(a), static_cast<const T*>(b));
+}
+
+template <typename T>
+double genericKernel(const void* a, const void* b, int dims) {
+    return cosineGeneric<T>(static_cast<const T*>(a), static_cast<const T*>(b), dims);
+}
+
+struct KernelEntry {
+    int dims;
+    int type;
+    CosineKernel kernel;
+};
+
+// 768 = ColorHistogramExtractor (3 x 256 bins), 2560 = ColorCorrelogramExtractor (512 colors x 5 distances),
+// 24 = ColorSignatureExtractor (3 x 8 bins), the rest are the usual [CLUSTER] k values for BoVW histograms
+#define VIR_KERNEL_ENTRY(dims) { dims, CV_32F, &fixedKernel<dims, float> }, { dims, CV_64F, &fixedKernel<dims, double> }
+
+const KernelEntry kernelTable[] = {
+    VIR_KERNEL_ENTRY(768),
+    VIR_KERNEL_ENTRY(2560),
+    VIR_KERNEL_ENTRY(24),
+    VIR_KERNEL_ENTRY(50),
+    VIR_KERNEL_ENTRY(100),
+    VIR_KERNEL_ENTRY(200),
+    VIR_KERNEL_ENTRY(500),
+    VIR_KERNEL_ENTRY(1000),
+};
+
+#undef VIR_KERNEL_ENTRY
+
+const KernelEntry* findKernel(int dims, int type) {
+    for (const auto& entry : kernelTable) {
+        if (entry.dims == dims && entry.type == type) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+}
+
+CosineKernel selectCosineKernel(int dims, int type) {
+    const KernelEntry* entry = findKernel(dims, type);
+    if (entry) {
+        return entry->kernel;
+    }
+
+    if (type == CV_32F) {
+        return &genericKernel<float>;
+    }
+    if (type == CV_64F) {
+        return &genericKernel<double>;
+    }
+    return nullptr;
+}
+
+bool isSpecializedKernel(int dims, int type) {
+    return findKernel(dims, type) != nullptr;
+}
+
+SparseVector toSparse(const Mat& dense) {
+    SparseVector sparse;
+    Mat row;
+    dense.reshape(1, 1).convertTo(row, CV_32F);
+    sparse.dims = row.cols;
+
+    const float* values = row.ptr<float>(0);
+    for (int i = 0; i < row.cols; ++i) {
+        if (values[i] != 0.0f) {
+            sparse.indices.push_back(i);
+            sparse.values.push_back(values[i]);
+        }
+    }
+    return sparse;
+}
+
+Mat toDense(const SparseVector& sparse) {
+    Mat dense = Mat::zeros(1, sparse.dims, CV_32F);
+    float* values = dense.ptr<float>(0);
+    for (size_t i = 0; i < sparse.indices.size(); ++i) {
+        values[sparse.indices[i]] = sparse.values[i];
+    }
+    return dense;
+}
+
+double sparseNorm(const SparseVector& sparse) {
+    double norm = 0.0;
+    for (float value : sparse.values) {
+        norm += static_cast<double>(value) * value;
+    }
+    return std::sqrt(norm);
+}
+
+// Gathers only the non-zero bins of the sparse side
+double dotSparseDense(const SparseVector& sparse, const float* dense) {
+    double dotProduct = 0.0;
+    for (size_t i = 0; i < sparse.indices.size(); ++i) {
+        dotProduct += static_cast<double>(sparse.values[i]) * dense[sparse.indices[i]];
+    }
+    return dotProduct;
+}
+
+// Merge of two sorted index lists
+double dotSparseSparse(const SparseVector& a, const SparseVector& b) {
+    double dotProduct = 0.0;
+    size_t i = 0, j = 0;
+    while (i < a.indices.size() && j < b.indices.size()) {
+        if (a.indices[i] < b.indices[j]) {
+            ++i;
+        }
+        else if (a.indices[i] > b.indices[j]) {
+            ++j;
+        }
+        else {
+            dotProduct += static_cast<double>(a.values[i]) * b.values[j];
+            ++i;
+            ++j;
+        }
+    }
+    return dotProduct;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <vector>
+
+using namespace cv;
+
+// Cosine kernel on raw contiguous feature data; the dimension argument is ignored by fixed-size kernels
+typedef double (*CosineKernel)(const void* a, const void* b, int dims);
+
+// Independent accumulator lanes break the dependency chain so the fixed-trip loop unrolls into SIMD code
+const int KERNEL_LANES = 8;
+
+inline double finishCosine(double dotProduct, double normA, double normB) {
+    if (normA == 0.0 || normB == 0.0) {
+        return 0.0;
+    }
+    return dotProduct / (std::sqrt(normA) * std::sqrt(normB));
+}
+
+// Elements summed in T lanes before they are folded into the double totals: long enough for the unrolled
+// lanes to vectorize, short enough that float rounding never builds up beyond a single block
+const int KERNEL_BLOCK = 64;
+
+template <int Count, typename T>
+inline void accumulateBlock(const T* a, const T* b, double& dotProduct, double& normA, double& normB) {
+    T dot[KERNEL_LANES] = {};
+    T sumA[KERNEL_LANES] = {};
+    T sumB[KERNEL_LANES] = {};
+
+    const int body = Count / KERNEL_LANES * KERNEL_LANES;
+    for (int i = 0; i < body; i += KERNEL_LANES) {
+        for (int lane = 0; lane < KERNEL_LANES; ++lane) {
+            dot[lane] += a[i + lane] * b[i + lane];
+            sumA[lane] += a[i + lane] * a[i + lane];
+            sumB[lane] += b[i + lane] * b[i + lane];
+        }
+    }
+    for (int i = body; i < Count; ++i) {
+        dot[0] += a[i] * b[i];
+        sumA[0] += a[i] * a[i];
+        sumB[0] += b[i] * b[i];
+    }
+
+    for (int lane = 0; lane < KERNEL_LANES; ++lane) {
+        dotProduct += dot[lane];
+        normA += sumA[lane];
+        normB += sumB[lane];
+    }
+}
+
+template <int Dims, typename T>
+double cosineFixed(const T* a, const T* b) {
+    double dotProduct = 0.0, normA = 0.0, normB = 0.0;
+    const int blocks = Dims / KERNEL_BLOCK;
+    for (int block = 0; block < blocks; ++block) {
+        accumulateBlock<KERNEL_BLOCK, T>(a + block * KERNEL_BLOCK, b + block * KERNEL_BLOCK, dotProduct, normA, normB);
+    }
+    accumulateBlock<Dims % KERNEL_BLOCK, T>(a + blocks * KERNEL_BLOCK, b + blocks * KERNEL_BLOCK, dotProduct, normA, normB);
+    return finishCosine(dotProduct, normA, normB);
+}
+
+template <typename T>
+double cosineGeneric(const T* a, const T* b, int dims) {
+    double dotProduct = 0.0, normA = 0.0, normB = 0.0;
+    for (int i = 0; i < dims; ++i) {
+        dotProduct += static_cast<double>(a[i]) * b[i];
+        normA += static_cast<double>(a[i]) * a[i];
+        normB += static_cast<double>(b[i]) * b[i];
+    }
+    return finishCosine(dotProduct, normA, normB);
+}
+
+// Sparse feature row: sorted bin indices with their non-zero values
+struct SparseVector {
+    int dims = 0;
+    std::vector<int> indices;
+    std::vector<float> values;
+};
+
+SparseVector toSparse(const Mat& dense);
+Mat toDense(const SparseVector& sparse);
+double sparseNorm(const SparseVector& sparse);
+double dotSparseDense(const SparseVector& sparse, const float* dense);
+double dotSparseSparse(const SparseVector& a, const SparseVector& b);
+
+// Picks the kernel specialized for this feature size and element type (CV_32F or CV_64F),
+// or the generic loop when no specialization exists; returns nullptr for other element types
+CosineKernel selectCosineKernel(int dims, int type);
+bool isSpecializedKernel(int dims, int type);
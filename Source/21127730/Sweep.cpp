@@ -0,0 +1,290 @@
+#include "Sweep.hpp"
+#include <chrono>
+#include <iomanip>
+
+namespace {
+
+typedef std::vector<std::pair<std::string, Mat>> FeatureList;
+
+double percentile(std::vector<double> values, double fraction) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(fraction * (values.size() - 1) + 0.5));
+    return values[index];
+}
+
+// Everything that stays the same across grid points: decoded queries and their raw descriptors,
+// and the extracted database descriptors, each loaded or computed once
+struct SweepCache {
+    std::vector<std::string> queryPaths;
+    std::map<std::string, std::vector<Mat>> queryFeatures;
+    std::map<std::string, FeatureList> databaseFeatures;
+    std::vector<MemoryHandle> memory;
+};
+
+const FeatureList& cachedDatabase(SweepCache& cache, FeatureDatabase& db, const std::string& featureType, const std::string& dataset, std::string& path) {
+    auto cached = cache.databaseFeatures.find(featureType);
+    if (cached == cache.databaseFeatures.end()) {
+        cached = cache.databaseFeatures.emplace(featureType, db.loadFeatures(featureType, dataset, path)).first;
+        cache.memory.push_back(trackFeatureStore(featureType, cached->second));
+    }
+    return cached->second;
+}
+
+// A query can only be scored against a store when it has a feature of the store's size; images
+// without descriptors come out of extraction empty
+bool matchesStore(const Mat& query, const FeatureList& store) {
+    return !query.empty() && !store.empty() && query.total() == store.front().second.total();
+}
+
+// BoVW store of one local feature type at one k, built in memory from the cached descriptors,
+// with the queries encoded against the same codebook
+struct EncodedStore {
+    Mat centers;
+    FeatureList histograms;
+    std::vector<Mat> queries;
+    double buildSeconds = 0.0;
+};
+
+EncodedStore encodeStore(SweepCache& cache, FeatureDatabase& db, const std::string& featureType, int k, const std::string& dataset, std::string& path) {
+    EncodedStore store;
+    const FeatureList& descriptors = cachedDatabase(cache, db, featureType, dataset, path);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cv::theRNG().state = 42;
+    store.centers = ClusteringFeature(descriptors, k);
+    store.histograms = CalculateHistograms(descriptors, store.centers);
+    auto end = std::chrono::high_resolution_clock::now();
+    store.buildSeconds = std::chrono::duration<double>(end - start).count();
+
+    for (const auto& queryDescriptors : cache.queryFeatures[featureType]) {
+        Mat copy = queryDescriptors.clone();
+        store.queries.push_back(copy.empty() ? Mat() : CalculateQueryHistograms(copy, store.centers));
+    }
+    return store;
+}
+
+}
+
+std::vector<SweepResult> runParameterSweep(FeatureDatabase db, const std::string& queryFolderPath, const std::vector<std::string>& featureTypes, const std::vector<int>& ks, const std::vector<double>& weights, const SweepIndexGrid& indexGrid, const std::set<std::string>& localFeatures, const std::string& dataset, std::string path, int numResults, const std::map<std::string, std::set<std::string>>& groundTruth) {
+    std::vector<SweepResult> results;
+    SweepCache cache;
+
+    // Decode every query once and extract each feature type the grid needs once
+    std::set<std::string> extractTypes;
+    for (const auto& featureType : featureTypes) {
+        if (featureType == "sift_histogram") {
+            extractTypes.insert("sift");
+            extractTypes.insert("histogram");
+        }
+        else {
+            extractTypes.insert(featureType);
+        }
+    }
+
+    for (const auto& entry : std::filesystem::directory_iterator(queryFolderPath)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+        Mat image = cv::imread(entry.path().string(), cv::IMREAD_COLOR);
+        if (image.empty()) {
+            std::cerr << "Failed to read image: " << entry.path().string() << std::endl;
+            continue;
+        }
+
+        cache.queryPaths.push_back(entry.path().string());
+        for (const auto& featureType : extractTypes) {
+            cache.queryFeatures[featureType].push_back(extractFeaturesFromImage(image, featureType));
+        }
+    }
+    std::cout << "Sweeping " << cache.queryPaths.size() << " queries" << std::endl;
+
+    // Runs every usable query through one configured scorer and fills in accuracy and latency.
+    // Every setting times the same thing: ranking an already encoded query, with extraction and
+    // codebook encoding done beforehand, so latencies compare across settings. Unusable queries
+    // score AP 0, so every setting's MAP is taken over the same full query set.
+    auto evaluate = [&](SweepResult& result, const std::function<bool(size_t)>& usable, const std::function<std::vector<std::pair<std::string, double>>(size_t)>& query) {
+        std::vector<double> latencies;
+        double totalMap = 0.0;
+        for (size_t i = 0; i < cache.queryPaths.size(); ++i) {
+            if (!usable(i)) {
+                result.skippedQueries++;
+                continue;
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<std::pair<std::string, double>> ranked = query(i);
+            auto end = std::chrono::high_resolution_clock::now();
+            latencies.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+            std::vector<std::string> retrieved_filenames;
+            for (const auto& score : ranked) {
+                retrieved_filenames.push_back(get_image_name(score.first));
+            }
+            totalMap += calculate_map(cache.queryPaths[i], retrieved_filenames, groundTruth);
+        }
+
+        result.map = cache.queryPaths.empty() ? 0.0 : totalMap / cache.queryPaths.size();
+        result.p50Ms = percentile(latencies, 0.5);
+        result.p99Ms = percentile(latencies, 0.99);
+        results.push_back(result);
+        std::cout << result.setting.featureType << " k=" << result.setting.k << " w=" << result.setting.weight
+            << " chunk=" << result.setting.chunkRows << " r=" << result.setting.hashRadius << ": MAP " << result.map;
+        if (result.skippedQueries > 0) {
+            std::cout << " (" << result.skippedQueries << " queries without features scored 0)";
+        }
+        std::cout << std::endl;
+    };
+
+    for (const auto& featureType : featureTypes) {
+        if (featureType == "sift_histogram") {
+            const FeatureList& histograms = cachedDatabase(cache, db, "histogram", dataset, path);
+            for (int k : ks) {
+                EncodedStore sift = encodeStore(cache, db, "sift", k, dataset, path);
+                for (double weight : weights) {
+                    SweepResult result;
+                    result.setting = { featureType, k, weight };
+                    result.buildSeconds = sift.buildSeconds;
+                    result.memoryBytes = featureBytes(sift.histograms) + featureBytes(histograms) + matBytes(sift.centers);
+                    evaluate(result, [&](size_t i) {
+                        return matchesStore(sift.queries[i], sift.histograms) && matchesStore(cache.queryFeatures["histogram"][i], histograms);
+                    }, [&](size_t i) {
+                        return rankFusedBySimilarity(sift.queries[i], sift.histograms, cache.queryFeatures["histogram"][i], histograms, weight, numResults);
+                    });
+                }
+            }
+        }
+        else if (localFeatures.count(featureType)) {
+            for (int k : ks) {
+                EncodedStore store = encodeStore(cache, db, featureType, k, dataset, path);
+                SweepResult result;
+                result.setting = { featureType, k, 0.0 };
+                result.buildSeconds = store.buildSeconds;
+                result.memoryBytes = featureBytes(store.histograms) + matBytes(store.centers);
+                evaluate(result, [&](size_t i) {
+                    return matchesStore(store.queries[i], store.histograms);
+                }, [&](size_t i) {
+                    return rankBySimilarity(store.queries[i], store.histograms, numResults);
+                });
+            }
+        }
+        else if (featureType == "phash") {
+            // One multi-index table serves every radius; the radius only changes how far each lookup probes
+            const FeatureList& hashes = cachedDatabase(cache, db, featureType, dataset, path);
+            auto start = std::chrono::high_resolution_clock::now();
+            MultiIndexHash index;
+            index.build(hashes);
+            double buildSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+            for (int radius : indexGrid.hashRadii) {
+                SweepResult result;
+                result.setting = { featureType, 0, 0.0, 0, radius };
+                result.buildSeconds = buildSeconds;
+                result.memoryBytes = index.memoryBytes();
+                evaluate(result, [&](size_t i) {
+                    const Mat& hash = cache.queryFeatures[featureType][i];
+                    return !hash.empty() && hash.total() * hash.elemSize() == 8;
+                }, [&](size_t i) {
+                    std::vector<std::pair<std::string, double>> ranked;
+                    for (const auto& hit : index.search(packHash(cache.queryFeatures[featureType][i]), radius)) {
+                        if (static_cast<int>(ranked.size()) == numResults) {
+                            break;
+                        }
+                        ranked.emplace_back(hit.first, -hit.second);
+                    }
+                    return ranked;
+                });
+            }
+        }
+        else {
+            // Global features have nothing to rebuild per setting
+            const FeatureList& features = cachedDatabase(cache, db, featureType, dataset, path);
+            SweepResult result;
+            result.setting = { featureType, 0, 0.0 };
+            result.memoryBytes = featureBytes(features);
+            evaluate(result, [&](size_t i) {
+                return matchesStore(cache.queryFeatures[featureType][i], features);
+            }, [&](size_t i) {
+                return rankBySimilarity(cache.queryFeatures[featureType][i], features, numResults);
+            });
+
+            // Deadline-bounded scans: only the chunk index is rebuilt per chunk size
+            if (indexGrid.budgetMs <= 0 || indexGrid.chunkRows.empty()) {
+                continue;
+            }
+            FeatureMatrix matrix = packFeatures(features);
+            MemoryHandle matrixMemory = trackFeatureMatrix("sweep/" + featureType, matrix);
+            std::chrono::microseconds budget(static_cast<long long>(indexGrid.budgetMs * 1000));
+            for (int chunkRows : indexGrid.chunkRows) {
+                auto start = std::chrono::high_resolution_clock::now();
+                ChunkIndex index = buildChunkIndex(matrix, chunkRows);
+                auto end = std::chrono::high_resolution_clock::now();
+
+                SweepResult chunked;
+                chunked.setting = { featureType, 0, 0.0, chunkRows, 0 };
+                chunked.buildSeconds = std::chrono::duration<double>(end - start).count();
+                chunked.memoryBytes = matBytes(matrix.data) + matrix.norms.capacity() * sizeof(double) + matBytes(index.centroids)
+                    + index.order.capacity() * sizeof(int);
+                evaluate(chunked, [&](size_t i) {
+                    return matchesStore(cache.queryFeatures[featureType][i], features);
+                }, [&](size_t i) {
+                    return rankWithinDeadline(cache.queryFeatures[featureType][i], matrix, index, numResults, budget).results;
+                });
+            }
+        }
+    }
+
+    markParetoFrontier(results);
+    return results;
+}
+
+// A setting is on the accuracy-vs-latency frontier when no other setting has at least its MAP
+// at no more p50 latency while being strictly better on one of them
+void markParetoFrontier(std::vector<SweepResult>& results) {
+    for (auto& candidate : results) {
+        candidate.pareto = true;
+        for (const auto& other : results) {
+            bool noWorse = other.map >= candidate.map && other.p50Ms <= candidate.p50Ms;
+            bool better = other.map > candidate.map || other.p50Ms < candidate.p50Ms;
+            if (noWorse && better) {
+                candidate.pareto = false;
+                break;
+            }
+        }
+    }
+}
+
+void printSweepTable(const std::vector<SweepResult>& results, std::ostream& out) {
+    out << std::left << std::setw(16) << "Feature" << std::right << std::setw(6) << "k" << std::setw(8) << "Weight"
+        << std::setw(7) << "Chunk" << std::setw(7) << "Radius" << std::setw(10) << "MAP" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms"
+        << std::setw(12) << "Memory KB" << std::setw(10) << "Build s" << std::setw(9) << "Skipped" << std::setw(8) << "Pareto" << std::endl;
+    for (const auto& result : results) {
+        out << std::left << std::setw(16) << result.setting.featureType << std::right << std::setw(6) << result.setting.k
+            << std::setw(8) << result.setting.weight << std::setw(7) << result.setting.chunkRows << std::setw(7) << result.setting.hashRadius
+            << std::setw(10) << std::fixed << std::setprecision(4) << result.map
+            << std::setw(10) << std::setprecision(3) << result.p50Ms << std::setw(10) << result.p99Ms
+            << std::setw(12) << std::setprecision(1) << result.memoryBytes / 1024.0 << std::setw(10) << std::setprecision(2) << result.buildSeconds
+            << std::setw(9) << result.skippedQueries << std::setw(8) << (result.pareto ? "*" : "") << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+}
+
+bool saveSweepTable(const std::vector<SweepResult>& results, const std::string& filename) {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file for writing: " << filename << std::endl;
+        return false;
+    }
+
+    file << "feature,k,weight,chunk_rows,hash_radius,map,p50_ms,p99_ms,memory_bytes,build_seconds,skipped_queries,pareto\n";
+    for (const auto& result : results) {
+        file << result.setting.featureType << "," << result.setting.k << "," << result.setting.weight << "," << result.setting.chunkRows << ","
+            << result.setting.hashRadius << "," << result.map << ","
+            << result.p50Ms << "," << result.p99Ms << "," << result.memoryBytes << "," << result.buildSeconds << ","
+            << result.skippedQueries << "," << (result.pareto ? 1 : 0) << "\n";
+    }
+    file.close();
+    std::cout << "Sweep results saved to " << filename << std::endl;
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "Database.hpp"
+#include "Codebook.hpp"
+#include "Processing.hpp"
+#include "Retrieval.hpp"
+#include "Evaluation.hpp"
+#include "HashIndex.hpp"
+#include <opencv2/opencv.hpp>
+#include <set>
+#include <vector>
+
+// One grid point: k only applies to local features, the weight only to the fused sift+histogram setting,
+// chunkRows only to deadline-bounded scans of global features and hashRadius only to phash
+struct SweepSetting {
+    std::string featureType;
+    int k = 0;
+    double weight = 0.0;
+    int chunkRows = 0;
+    int hashRadius = 0;
+};
+
+// Index parameters swept next to the feature grid: chunk sizes of the chunk index behind [RETRIEVE] budget_ms
+// (global features, only with a budget) and Hamming radii of the phash multi-index lookup
+struct SweepIndexGrid {
+    std::vector<int> chunkRows;
+    double budgetMs = 0.0;
+    std::vector<int> hashRadii;
+};
+
+struct SweepResult {
+    SweepSetting setting;
+    double map = 0.0;
+    double p50Ms = 0.0;
+    double p99Ms = 0.0;
+    size_t memoryBytes = 0;
+    double buildSeconds = 0.0;
+    // Queries that produced no feature of the store's size; they count as AP 0 in the MAP
+    int skippedQueries = 0;
+    bool pareto = false;
+};
+
+std::vector<SweepResult> runParameterSweep(FeatureDatabase db, const std::string& queryFolderPath, const std::vector<std::string>& featureTypes, const std::vector<int>& ks, const std::vector<double>& weights, const SweepIndexGrid& indexGrid, const std::set<std::string>& localFeatures, const std::string& dataset, std::string path, int numResults, const std::map<std::string, std::set<std::string>>& groundTruth);
+void markParetoFrontier(std::vector<SweepResult>& results);
+void printSweepTable(const std::vector<SweepResult>& results, std::ostream& out);
+bool saveSweepTable(const std::vector<SweepResult>& results, const std::string& filename);
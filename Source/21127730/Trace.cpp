@@ -0,0 +1,137 @@
+#include "Trace.hpp"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <thread>
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer() : enabled_(false), epoch_(Clock::now()) {
+}
+
+void Tracer::enable(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+long long Tracer::toMicroseconds(Clock::time_point time) const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - epoch_).count();
+}
+
+void Tracer::recordSpan(const char* name, Clock::time_point start, Clock::time_point end) {
+    Span span;
+    span.name = name;
+    span.startUs = toMicroseconds(start);
+    span.durationUs = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    span.threadId = std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    spans_.push_back(span);
+}
+
+void Tracer::addCounter(const char* name, double value) {
+    Counter counter;
+    counter.name = name;
+    counter.timeUs = toMicroseconds(Clock::now());
+    counter.value = value;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    counters_.push_back(counter);
+}
+
+bool Tracer::writeChromeTrace(const std::string& filename) const {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open file for writing: " << filename << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    file << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (const auto& span : spans_) {
+        file << (first ? "" : ",\n") << "{\"name\":\"" << span.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.threadId
+            << ",\"ts\":" << span.startUs << ",\"dur\":" << span.durationUs << "}";
+        first = false;
+    }
+    for (const auto& counter : counters_) {
+        file << (first ? "" : ",\n") << "{\"name\":\"" << counter.name << "\",\"ph\":\"C\",\"pid\":1,\"ts\":" << counter.timeUs
+            << ",\"args\":{\"value\":" << counter.value << "}}";
+        first = false;
+    }
+    file << "\n]}\n";
+
+    file.close();
+    std::cout << "Trace saved to " << filename << std::endl;
+    return true;
+}
+
+void Tracer::printSummary(std::ostream& out) const {
+    struct SpanTotals {
+        size_t calls = 0;
+        long long totalUs = 0;
+        long long maxUs = 0;
+    };
+    struct CounterTotals {
+        size_t samples = 0;
+        double total = 0.0;
+        double max = 0.0;
+    };
+
+    std::map<std::string, SpanTotals> spanTotals;
+    std::map<std::string, CounterTotals> counterTotals;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& span : spans_) {
+            SpanTotals& totals = spanTotals[span.name];
+            totals.calls++;
+            totals.totalUs += span.durationUs;
+            totals.maxUs = std::max(totals.maxUs, span.durationUs);
+        }
+        for (const auto& counter : counters_) {
+            CounterTotals& totals = counterTotals[counter.name];
+            totals.max = totals.samples == 0 ? counter.value : std::max(totals.max, counter.value);
+            totals.samples++;
+            totals.total += counter.value;
+        }
+    }
+
+    out << std::left << std::setw(24) << "Stage" << std::right << std::setw(8) << "Calls" << std::setw(14) << "Total ms"
+        << std::setw(14) << "Mean ms" << std::setw(14) << "Max ms" << std::endl;
+    for (const auto& entry : spanTotals) {
+        const SpanTotals& totals = entry.second;
+        out << std::left << std::setw(24) << entry.first << std::right << std::setw(8) << totals.calls
+            << std::setw(14) << totals.totalUs / 1000.0 << std::setw(14) << totals.totalUs / 1000.0 / totals.calls
+            << std::setw(14) << totals.maxUs / 1000.0 << std::endl;
+    }
+
+    if (counterTotals.empty()) {
+        return;
+    }
+
+    out << std::endl << std::left << std::setw(24) << "Counter" << std::right << std::setw(8) << "Samples" << std::setw(14) << "Total"
+        << std::setw(14) << "Mean" << std::setw(14) << "Max" << std::endl;
+    for (const auto& entry : counterTotals) {
+        const CounterTotals& totals = entry.second;
+        out << std::left << std::setw(24) << entry.first << std::right << std::setw(8) << totals.samples
+            << std::setw(14) << totals.total << std::setw(14) << totals.total / totals.samples
+            << std::setw(14) << totals.max << std::endl;
+    }
+}
+
+TraceExport::~TraceExport() {
+    Tracer& tracer = Tracer::instance();
+    if (!tracer.enabled()) {
+        return;
+    }
+    if (format_ == "chrome") {
+        tracer.writeChromeTrace(output_);
+    }
+    else {
+        tracer.printSummary(std::cout);
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Collects timed spans and counters for each pipeline stage.
+// Recording is skipped entirely while the tracer is disabled, so instrumented code costs one relaxed load.
+class Tracer {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static Tracer& instance();
+
+    void enable(bool enabled);
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    void recordSpan(const char* name, Clock::time_point start, Clock::time_point end);
+    void addCounter(const char* name, double value);
+
+    // Chrome trace-event JSON, viewable in chrome://tracing or Perfetto
+    bool writeChromeTrace(const std::string& filename) const;
+    void printSummary(std::ostream& out) const;
+
+private:
+    struct Span {
+        const char* name;
+        long long startUs;
+        long long durationUs;
+        size_t threadId;
+    };
+
+    struct Counter {
+        const char* name;
+        long long timeUs;
+        double value;
+    };
+
+    Tracer();
+    long long toMicroseconds(Clock::time_point time) const;
+
+    std::atomic<bool> enabled_;
+    Clock::time_point epoch_;
+    mutable std::mutex mutex_;
+    std::vector<Span> spans_;
+    std::vector<Counter> counters_;
+};
+
+// Records the lifetime of a scope as a span named after the stage
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* name) : name_(name), active_(Tracer::instance().enabled()) {
+        if (active_) {
+            start_ = Tracer::Clock::now();
+        }
+    }
+
+    ~ScopedTimer() {
+        if (active_) {
+            Tracer::instance().recordSpan(name_, start_, Tracer::Clock::now());
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char* name_;
+    bool active_;
+    Tracer::Clock::time_point start_;
+};
+
+// Writes the trace when it goes out of scope, so runs that stop early (bad arguments, missing store) are reported too
+class TraceExport {
+public:
+    TraceExport(const std::string& format, const std::string& output) : format_(format), output_(output) {}
+    ~TraceExport();
+
+    TraceExport(const TraceExport&) = delete;
+    TraceExport& operator=(const TraceExport&) = delete;
+
+private:
+    std::string format_;
+    std::string output_;
+};
+
+// Define VIR_DISABLE_TRACE to compile the instrumentation out completely
+#ifdef VIR_DISABLE_TRACE
+#define TRACE_SCOPE(name)
+#define TRACE_COUNTER(name, value)
+#else
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) ScopedTimer TRACE_CONCAT(traceScope_, __LINE__)(name)
+#define TRACE_COUNTER(name, value) do { if (Tracer::instance().enabled()) Tracer::instance().addCounter(name, static_cast<double>(value)); } while (0)
+#endif
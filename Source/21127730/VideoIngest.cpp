@@ -0,0 +1,270 @@
+#include "VideoIngest.hpp"
+#include <chrono>
+#include <deque>
+#include <iomanip>
+
+namespace {
+
+// Shot boundaries only need coarse color statistics, so frames are shrunk before the histogram
+const int SIGNATURE_SIDE = 160;
+
+Mat frameSignature(const Mat& frame) {
+    Mat small = frame;
+    int maxSide = std::max(frame.cols, frame.rows);
+    if (maxSide > SIGNATURE_SIDE) {
+        double scale = static_cast<double>(SIGNATURE_SIDE) / maxSide;
+        cv::resize(frame, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    }
+    ColorHistogramExtractor extractor;
+    return extractor.extractFeature(small);
+}
+
+// Bounded hand-off between the decoding thread and the extraction workers
+class KeyframeQueue {
+public:
+    explicit KeyframeQueue(size_t capacity) : capacity_(std::max<size_t>(1, capacity)) {}
+
+    void push(Keyframe&& keyframe) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this]() { return queue_.size() < capacity_; });
+        queue_.push_back(std::move(keyframe));
+        notEmpty_.notify_one();
+    }
+
+    bool pop(Keyframe& keyframe) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this]() { return !queue_.empty() || closed_; });
+        if (queue_.empty()) {
+            return false;
+        }
+        keyframe = std::move(queue_.front());
+        queue_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    std::deque<Keyframe> queue_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+};
+
+}
+
+bool isVideoFile(const std::string& path) {
+    static const std::set<std::string> extensions = { ".mp4", ".avi", ".mov", ".mkv", ".webm", ".mpg", ".mpeg", ".m4v", ".wmv" };
+    std::string extension = std::filesystem::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    return extensions.count(extension) > 0;
+}
+
+// Segments are named with a media fragment, e.g. "clip.mp4#t=12.480,15.120" (seconds)
+std::string makeSegmentId(const std::string& videoPath, double startMs, double endMs) {
+    std::ostringstream id;
+    id << videoPath << "#t=" << std::fixed << std::setprecision(3) << startMs / 1000.0 << "," << endMs / 1000.0;
+    return id.str();
+}
+
+bool parseSegmentId(const std::string& id, std::string& videoPath, double& startMs, double& endMs) {
+    size_t marker = id.rfind("#t=");
+    if (marker == std::string::npos) {
+        return false;
+    }
+
+    std::vector<std::string> times = split(id.substr(marker + 3), ',');
+    if (times.empty()) {
+        return false;
+    }
+    try {
+        startMs = std::stod(times[0]) * 1000.0;
+        endMs = times.size() > 1 ? std::stod(times[1]) * 1000.0 : startMs;
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    videoPath = id.substr(0, marker);
+    return true;
+}
+
+// Stored paths are either still images or video segments; segments are shown by their first frame
+Mat readImageOrKeyframe(const std::string& path) {
+    std::string videoPath;
+    double startMs = 0.0;
+    double endMs = 0.0;
+    if (!parseSegmentId(path, videoPath, startMs, endMs)) {
+        return cv::imread(path, cv::IMREAD_COLOR);
+    }
+
+    cv::VideoCapture capture(videoPath);
+    Mat frame;
+    if (capture.isOpened()) {
+        capture.set(cv::CAP_PROP_POS_MSEC, startMs);
+        capture.read(frame);
+    }
+    return frame;
+}
+
+// Half the L1 distance between two normalized histograms: 0 for identical frames, 1 for disjoint colors
+double shotDistance(const Mat& previousSignature, const Mat& signature) {
+    if (previousSignature.empty() || previousSignature.size() != signature.size()) {
+        return 1.0;
+    }
+    return cv::norm(previousSignature, signature, cv::NORM_L1) / 2.0;
+}
+
+// Decodes one video and emits a keyframe per shot. A keyframe is held back until the next shot
+// starts (or the video ends) so that its segment end is known when it is emitted
+int selectKeyframes(const std::string& videoPath, const VideoIngestOptions& options, const std::function<void(Keyframe&&)>& emit) {
+    cv::VideoCapture capture(videoPath);
+    if (!capture.isOpened()) {
+        std::cerr << "Failed to open video: " << videoPath << std::endl;
+        return 0;
+    }
+
+    int stride = std::max(1, options.sampleStride);
+    int emitted = 0;
+    long long frameIndex = 0;
+    Keyframe pending;
+    Mat pendingSignature;
+    double lastMs = 0.0;
+
+    Mat frame;
+    while (true) {
+        bool sampled = frameIndex % stride == 0;
+        {
+            TRACE_SCOPE("decode");
+            // Frames between samples are only grabbed, which skips the color conversion
+            if (sampled ? !capture.read(frame) : !capture.grab()) {
+                break;
+            }
+        }
+        lastMs = capture.get(cv::CAP_PROP_POS_MSEC);
+        ++frameIndex;
+        if (!sampled || frame.empty()) {
+            continue;
+        }
+
+        Mat signature;
+        {
+            TRACE_SCOPE("shot_detect");
+            signature = frameSignature(frame);
+        }
+        if (!pendingSignature.empty() && shotDistance(pendingSignature, signature) < options.shotThreshold) {
+            continue;
+        }
+
+        if (!pending.frame.empty()) {
+            pending.endMs = lastMs;
+            pending.id = makeSegmentId(videoPath, pending.startMs, pending.endMs);
+            emit(std::move(pending));
+            ++emitted;
+        }
+        pending = Keyframe();
+        pending.frame = frame.clone();
+        pending.startMs = lastMs;
+        pendingSignature = signature;
+    }
+
+    if (!pending.frame.empty()) {
+        pending.endMs = lastMs;
+        pending.id = makeSegmentId(videoPath, pending.startMs, pending.endMs);
+        emit(std::move(pending));
+        ++emitted;
+    }
+    return emitted;
+}
+
+void extractAndSaveVideoFeatures(FeatureDatabase db, std::string videoPath, std::string featureType, std::string dataset, std::string path, const VideoIngestOptions& options) {
+    std::vector<std::string> videos;
+    if (std::filesystem::is_directory(videoPath)) {
+        for (const auto& entry : std::filesystem::directory_iterator(videoPath)) {
+            if (entry.is_regular_file() && isVideoFile(entry.path().string())) {
+                videos.push_back(entry.path().string());
+            }
+        }
+        std::sort(videos.begin(), videos.end());
+    }
+    else {
+        videos.push_back(videoPath);
+    }
+    if (videos.empty()) {
+        std::cerr << "No video files found in: " << videoPath << std::endl;
+        return;
+    }
+
+    // Shares the [MEMORY] ceiling and staged commit of image extraction; workers finish out of order,
+    // so pending keyframes are sorted to keep the stored order stable between runs
+    ExtractionSink sink(db, featureType, dataset, path, options.thumbnailSize, options.withSignature, true);
+    std::mutex resultsMutex;
+
+    // Decoding is sequential, so it gets one thread of its own and the expensive extractors
+    // run on the rest while it moves on to the next shot
+    int workerCount = options.workers > 0 ? options.workers : std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    KeyframeQueue queue(options.queueSize);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workerCount; ++i) {
+        workers.emplace_back([&]() {
+            Keyframe keyframe;
+            while (queue.pop(keyframe)) {
+                std::vector<uchar> thumbnail;
+                if (options.thumbnailSize > 0) {
+                    TRACE_SCOPE("thumbnail");
+                    thumbnail = makeThumbnail(keyframe.frame, options.thumbnailSize);
+                }
+
+                Mat signature;
+                if (options.withSignature && featureType != "signature") {
+                    signature = extractFeaturesFromImage(keyframe.frame, "signature");
+                }
+
+                Mat extractedFeatures = extractFeaturesFromImage(keyframe.frame, featureType);
+
+                std::lock_guard<std::mutex> lock(resultsMutex);
+                if (extractedFeatures.empty()) {
+                    std::cerr << "Feature extraction failed for keyframe: " << keyframe.id << std::endl;
+                }
+                sink.add(keyframe.id, extractedFeatures, signature, std::move(thumbnail));
+            }
+        });
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    double videoSeconds = 0.0;
+    int keyframes = 0;
+    for (const auto& video : videos) {
+        std::cout << "Processing video: " << video << std::endl;
+        double lastEndMs = 0.0;
+        int count = selectKeyframes(video, options, [&](Keyframe&& keyframe) {
+            lastEndMs = keyframe.endMs;
+            queue.push(std::move(keyframe));
+        });
+        std::cout << "  " << count << " keyframes" << std::endl;
+        keyframes += count;
+        videoSeconds += lastEndMs / 1000.0;
+    }
+    queue.close();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "Ingested " << videoSeconds << " s of video into " << keyframes << " keyframes in " << seconds << " s";
+    if (seconds > 0.0) {
+        std::cout << " (" << videoSeconds / seconds << "x real time)";
+    }
+    std::cout << std::endl;
+
+    if (!sink.commit()) {
+        return;
+    }
+    std::cout << "Features extracted and saved successfully!\n";
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "Database.hpp"
+#include "Processing.hpp"
+#include <opencv2/opencv.hpp>
+#include <opencv2/videoio.hpp>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// A shot's representative frame; its id names the video segment it stands for
+struct Keyframe {
+    std::string id;
+    Mat frame;
+    double startMs = 0.0;
+    double endMs = 0.0;
+};
+
+struct VideoIngestOptions {
+    double shotThreshold = 0.3; // Histogram distance in [0, 1] that starts a new shot
+    int sampleStride = 5;       // Only every stride-th decoded frame is compared
+    int workers = 0;            // Extraction threads, 0 uses every core but the decoder's
+    int queueSize = 32;         // Keyframes buffered between the decoder and the extractors
+    int thumbnailSize = 0;
+    bool withSignature = false;
+};
+
+bool isVideoFile(const std::string& path);
+std::string makeSegmentId(const std::string& videoPath, double startMs, double endMs);
+bool parseSegmentId(const std::string& id, std::string& videoPath, double& startMs, double& endMs);
+Mat readImageOrKeyframe(const std::string& path);
+double shotDistance(const Mat& previousSignature, const Mat& signature);
+int selectKeyframes(const std::string& videoPath, const VideoIngestOptions& options, const std::function<void(Keyframe&&)>& emit);
+void extractAndSaveVideoFeatures(FeatureDatabase db, std::string videoPath, std::string featureType, std::string dataset, std::string path, const VideoIngestOptions& options);
@@ -2,6 +2,17 @@
 #include "Codebook.hpp"
 #include "Retrieval.hpp"
 #include "Evaluation.hpp"
+#include "Dedup.hpp"
+#include "Cascade.hpp"
+#include "LiveIndex.hpp"
+#include "Distributed.hpp"
+#include "Sweep.hpp"
+#include "VideoIngest.hpp"
+#include "HashIndex.hpp"
+#include "RetrievalEngine.hpp"
+#include <atomic>
+#include <future>
+#include <thread>
 #include <opencv2/opencv.hpp>
 #include <filesystem>
 #include <iostream>
@@ -16,10 +27,45 @@ int main(int argc, char* argv[]) {
         std::unordered_map<std::string, std::unordered_map<std::string, std::string>> config;
         std::set<std::string> local_features;
         std::set<std::string> global_features;
+        // Binary hashes are matched by Hamming distance through their own index, never by the cosine scorers
+        std::set<std::string> hash_features;
         std::string database_path, TMBuD_label, CD_label;
 
         int k = 50;
         int n = 10;
+        int thumbnail_size = 128;
+        bool headless = false;
+        std::string montage_output = "result.jpg";
+        int batch_size = 64;
+        int tile_rows = 256;
+        double dedup_threshold = 0.98;
+        bool cascade_signature = false;
+        std::string cascade_stages = "signature:200,histogram:20";
+        int cascade_verify = 0;
+        int live_segments = 8;
+        int live_interval = 1000;
+        double budget_ms = 0;
+        int chunk_rows = 1024;
+        std::vector<std::string> workers;
+        int worker_timeout = 1000;
+        int worker_clients = 8;
+        double sift_weight = 0.5;
+        std::vector<std::string> sweep_features = { "sift", "orb", "histogram", "sift_histogram" };
+        std::vector<int> sweep_ks = { 20, 50, 100 };
+        std::vector<double> sweep_weights = { 0.3, 0.5, 0.7 };
+        std::string sweep_output = "sweep.csv";
+        SweepIndexGrid sweep_index;
+        VideoIngestOptions video_options;
+        size_t memory_ceiling = 0;
+        bool memory_report = false;
+        size_t stream_chunk = 0;
+        bool hash_shortcut = false;
+        int hash_radius = 4;
+        int engine_threads = 0;
+        std::string trace_format = "summary";
+        std::string trace_output = "trace.json";
+
+        auto config_start = Tracer::Clock::now();
         if (readConfig(config_file, config)) {
             std::stringstream ss(config["FEATURES"]["local"]);
             std::string feature;
@@ -30,6 +76,10 @@ int main(int argc, char* argv[]) {
             while (getline(ss2, feature, ',')) {
                 global_features.insert(feature);
             }
+            std::stringstream hashList(getConfigValue(config, "FEATURES", "hash", "phash"));
+            while (getline(hashList, feature, ',')) {
+                hash_features.insert(feature);
+            }
 
             std::cout << "Global features: " << config["FEATURES"]["global"] << std::endl;
             std::cout << "Local features: " << config["FEATURES"]["local"] << std::endl;
@@ -49,27 +99,124 @@ int main(int argc, char* argv[]) {
             
             TMBuD_label = config["CSV"]["TMBuD"];
             std::cout << "Path to TMBuD labels file: " << TMBuD_label << std::endl;
+
+            thumbnail_size = stoi(getConfigValue(config, "DISPLAY", "thumbnail", "128"));
+            headless = getConfigValue(config, "DISPLAY", "headless", "0") == "1";
+            montage_output = getConfigValue(config, "DISPLAY", "output", "result.jpg");
+
+            batch_size = stoi(getConfigValue(config, "BATCH", "queries", "64"));
+            tile_rows = stoi(getConfigValue(config, "BATCH", "tile", "256"));
+            dedup_threshold = stod(getConfigValue(config, "DEDUP", "threshold", "0.98"));
+            cascade_signature = getConfigValue(config, "CASCADE", "signature", "0") == "1";
+            cascade_stages = getConfigValue(config, "CASCADE", "stages", cascade_stages);
+            cascade_verify = stoi(getConfigValue(config, "CASCADE", "verify", "0"));
+            live_segments = stoi(getConfigValue(config, "LIVE", "segments", "8"));
+            live_interval = stoi(getConfigValue(config, "LIVE", "interval", "1000"));
+            budget_ms = stod(getConfigValue(config, "RETRIEVE", "budget_ms", "0"));
+            chunk_rows = stoi(getConfigValue(config, "RETRIEVE", "chunk", "1024"));
+
+            std::stringstream ss3(getConfigValue(config, "DISTRIBUTED", "workers", ""));
+            std::string worker;
+            while (getline(ss3, worker, ',')) {
+                workers.push_back(worker);
+            }
+            worker_timeout = stoi(getConfigValue(config, "DISTRIBUTED", "timeout_ms", "1000"));
+            worker_clients = stoi(getConfigValue(config, "DISTRIBUTED", "worker_clients", "8"));
+            sift_weight = stod(getConfigValue(config, "RETRIEVE", "sift_weight", "0.5"));
+
+            sweep_features = split(getConfigValue(config, "SWEEP", "features", "sift,orb,histogram,sift_histogram"), ',');
+            sweep_ks.clear();
+            for (const auto& value : split(getConfigValue(config, "SWEEP", "k", "20,50,100"), ',')) {
+                sweep_ks.push_back(stoi(value));
+            }
+            sweep_weights.clear();
+            for (const auto& value : split(getConfigValue(config, "SWEEP", "weights", "0.3,0.5,0.7"), ',')) {
+                sweep_weights.push_back(stod(value));
+            }
+            sweep_output = getConfigValue(config, "SWEEP", "output", "sweep.csv");
+            for (const auto& value : split(getConfigValue(config, "SWEEP", "chunk_rows", "256,1024,4096"), ',')) {
+                sweep_index.chunkRows.push_back(stoi(value));
+            }
+            sweep_index.budgetMs = stod(getConfigValue(config, "SWEEP", "budget_ms", "0"));
+            for (const auto& value : split(getConfigValue(config, "SWEEP", "hash_radius", "4,8,12"), ',')) {
+                sweep_index.hashRadii.push_back(stoi(value));
+            }
+
+            video_options.shotThreshold = stod(getConfigValue(config, "VIDEO", "threshold", "0.3"));
+            video_options.sampleStride = stoi(getConfigValue(config, "VIDEO", "stride", "5"));
+            video_options.workers = stoi(getConfigValue(config, "VIDEO", "workers", "0"));
+            video_options.queueSize = stoi(getConfigValue(config, "VIDEO", "queue", "32"));
+
+            memory_ceiling = static_cast<size_t>(stod(getConfigValue(config, "MEMORY", "ceiling_mb", "0")) * 1024 * 1024);
+            memory_report = getConfigValue(config, "MEMORY", "report", "0") == "1";
+            stream_chunk = static_cast<size_t>(stod(getConfigValue(config, "STREAM", "chunk_mb", "0")) * 1024 * 1024);
+            hash_shortcut = getConfigValue(config, "PHASH", "shortcut", "0") == "1";
+            hash_radius = stoi(getConfigValue(config, "PHASH", "radius", "4"));
+            engine_threads = stoi(getConfigValue(config, "ENGINE", "threads", "0"));
+
+            Tracer::instance().enable(getConfigValue(config, "TRACE", "enabled", "0") == "1");
+            trace_format = getConfigValue(config, "TRACE", "format", "summary");
+            trace_output = getConfigValue(config, "TRACE", "output", "trace.json");
+            if (Tracer::instance().enabled()) {
+                Tracer::instance().recordSpan("config", config_start, Tracer::Clock::now());
+            }
         }
 
+        // Every return below, early or not, exports the trace on the way out
+        TraceExport traceExport(trace_format, trace_output);
+
         std::string mode = argv[1];
 
         FeatureDatabase db;
+        db.setSparseDensity(stod(getConfigValue(config, "SPARSE", "density", "0")));
+        db.setMemoryCeiling(memory_ceiling);
+        db.setStreamChunkBytes(stream_chunk);
         if (mode == "extract") {
             std::string folderPath = argv[2];
             std::string featureType = argv[3];
             std::string dataset = argv[4];
 
-            if (!checkExist(local_features, featureType) && !checkExist(global_features, featureType)) {
+            if (!checkExist(local_features, featureType) && !checkExist(global_features, featureType) && !checkExist(hash_features, featureType)) {
                 std::cerr << "Invalid feature type!" << std::endl;
                 return 0;
             }
 
-            extractAndSaveFeatures(db, folderPath, featureType, dataset, database_path);
+            extractAndSaveFeatures(db, folderPath, featureType, dataset, database_path, thumbnail_size, cascade_signature);
 
             std::string config_file = "config.ini";  // Replace with your config file path
 
             // Read local and global features from the config file
 
+            std::string store = featureType;
+            if (checkExist(local_features, featureType)) {
+                std::cout << "Creating codebook and plot histogram..." << std::endl;
+                clusterAndSaveCodebook(db, featureType, dataset, k, database_path);
+                plotAndSaveHistogram(db, featureType, dataset, database_path);
+                store = featureType + "_histogram";
+            }
+
+            if (stream_chunk > 0 && !checkExist(hash_features, featureType)) {
+                std::cout << "Writing row store for streamed scans..." << std::endl;
+                db.saveRowStore(store, dataset, database_path);
+            }
+
+            std::cout << "Finish extracting!" << std::endl;
+        }
+
+        else if (mode == "video") {
+            std::string videoPath = argv[2];
+            std::string featureType = argv[3];
+            std::string dataset = argv[4];
+
+            if (!checkExist(local_features, featureType) && !checkExist(global_features, featureType) && !checkExist(hash_features, featureType)) {
+                std::cerr << "Invalid feature type!" << std::endl;
+                return 0;
+            }
+
+            video_options.thumbnailSize = thumbnail_size;
+            video_options.withSignature = cascade_signature;
+            extractAndSaveVideoFeatures(db, videoPath, featureType, dataset, database_path, video_options);
+
             if (checkExist(local_features, featureType)) {
                 std::cout << "Creating codebook and plot histogram..." << std::endl;
                 clusterAndSaveCodebook(db, featureType, dataset, k, database_path);
@@ -84,9 +231,39 @@ int main(int argc, char* argv[]) {
             std::string featureType = argv[3];
             std::string dataset = argv[4];
             std::vector<std::string> topImages;
+            Mat image;
+
+            // Re-uploads and light re-encodes are answered from the hash index before any expensive extraction
+            std::vector<std::string> duplicates;
+            if (hash_shortcut || featureType == "phash") {
+                {
+                    TRACE_SCOPE("decode");
+                    image = cv::imread(queryImagePath, cv::IMREAD_COLOR);
+                }
+                if (image.empty()) {
+                    std::cerr << "Failed to read image" << std::endl;
+                    return 0;
+                }
+
+                auto start = std::chrono::high_resolution_clock::now();
+                std::vector<std::pair<std::string, int>> hits = findNearDuplicates(image, db, dataset, database_path, hash_radius, n);
+                auto end = std::chrono::high_resolution_clock::now();
+                std::chrono::duration<double> duration = end - start;
+                for (const auto& hit : hits) {
+                    std::cout << "Near duplicate: " << hit.first << " (" << hit.second << " bits)" << std::endl;
+                    duplicates.push_back(hit.first);
+                }
+                std::cout << "Hash lookup: " << duplicates.size() << " hits in " << duration.count() << " seconds" << std::endl;
+            }
 
-            if (featureType == "sift_histogram") {
-                Mat image = cv::imread(queryImagePath, cv::IMREAD_COLOR);
+            if (!duplicates.empty() || featureType == "phash") {
+                topImages = duplicates;
+            }
+            else if (featureType == "sift_histogram") {
+                if (image.empty()) {
+                    TRACE_SCOPE("decode");
+                    image = cv::imread(queryImagePath, cv::IMREAD_COLOR);
+                }
                 if (image.empty()) {
                     std::cerr << "Failed to read image" << std::endl;
                     return 0;
@@ -100,20 +277,49 @@ int main(int argc, char* argv[]) {
                 Mat queryHistogram = extractFeaturesFromImage(image, "histogram");
 
                 auto start = std::chrono::high_resolution_clock::now();
-                topImages = retrivalSIFTHistogram(image, db, querySift, queryHistogram, dataset, n, database_path);
+                TRACE_SCOPE("retrieve");
+                topImages = retrivalSIFTHistogram(image, db, querySift, queryHistogram, dataset, n, database_path, sift_weight);
 
                 auto end = std::chrono::high_resolution_clock::now();
                 std::chrono::duration<double> duration = end - start;
                 std::cout << "Total runtime: " << duration.count() << " seconds" << std::endl;
 
             }
+            else if (featureType == "cascade") {
+                if (image.empty()) {
+                    TRACE_SCOPE("decode");
+                    image = cv::imread(queryImagePath, cv::IMREAD_COLOR);
+                }
+                if (image.empty()) {
+                    std::cerr << "Failed to read image" << std::endl;
+                    return 0;
+                }
+                std::cout << "Read image successful!" << std::endl;
+
+                std::vector<CascadeStage> stages = parseCascadeStages(cascade_stages);
+                if (stages.empty()) {
+                    std::cerr << "No valid cascade stages configured" << std::endl;
+                    return 0;
+                }
+
+                auto start = std::chrono::high_resolution_clock::now();
+                TRACE_SCOPE("retrieve");
+                topImages = retrievalCascade(image, db, stages, local_features, dataset, n, cascade_verify, database_path);
+
+                auto end = std::chrono::high_resolution_clock::now();
+                std::chrono::duration<double> duration = end - start;
+                std::cout << "Total runtime: " << duration.count() << " seconds" << std::endl;
+            }
             else {
                 if (!checkExist(local_features, featureType) && !checkExist(global_features, featureType)) {
                     std::cerr << "Invalid feature type!" << std::endl;
                     return 0;
                 }
 
-                Mat image = cv::imread(queryImagePath, cv::IMREAD_COLOR);
+                if (image.empty()) {
+                    TRACE_SCOPE("decode");
+                    image = cv::imread(queryImagePath, cv::IMREAD_COLOR);
+                }
                 if (image.empty()) {
                     std::cerr << "Failed to read image" << std::endl;
                     return 0;
@@ -135,30 +341,461 @@ int main(int argc, char* argv[]) {
                 std::cout << "Extract feature from image successful!" << std::endl;
 
                 auto start = std::chrono::high_resolution_clock::now();
-                topImages = findTopSimilarImages(image, db, query_feature, data, dataset, n, database_path);
+                TRACE_SCOPE("retrieve");
+                if (budget_ms > 0) {
+                    topImages = findTopSimilarImagesWithin(db, query_feature, data, dataset, n, database_path, budget_ms, chunk_rows);
+                }
+                else {
+                    topImages = findTopSimilarImages(image, db, query_feature, data, dataset, n, database_path);
+                }
 
                 auto end = std::chrono::high_resolution_clock::now();
                 std::chrono::duration<double> duration = end - start;
                 std::cout << "Total runtime: " << duration.count() << " seconds" << std::endl;
             }
 
+            {
+                TRACE_SCOPE("evaluate");
+                std::vector<std::string> retrieved_filenames;
+                for (const auto& path : topImages) {
+                    retrieved_filenames.push_back(get_image_name(path));
+                }
+
+                std::map<std::string, std::set<std::string>> ground_truth;
+                if (dataset == "TMBuD") {
+                    ground_truth = load_csv(TMBuD_label); 
+                }
+                else if (dataset == "CD") {
+                    ground_truth = load_csv(CD_label);
+                }
+                double map_score = calculate_map(queryImagePath, retrieved_filenames, ground_truth);
+                std::cout << "MAP score: " << map_score << std::endl;
+            }
+            
+            if (headless) {
+                std::unordered_map<std::string, std::vector<uchar>> thumbnails = db.loadThumbnails(dataset, database_path, thumbnail_size);
+                MemoryHandle thumbnailMemory("thumbnails/" + dataset, thumbnailBytes(thumbnails), thumbnails.size());
+                renderResultMontage(image, topImages, thumbnails, thumbnail_size, montage_output);
+            }
+            else {
+                displayImagesInSeparateWindows(queryImagePath, topImages);
+            }
+            queryImagePath = "";
+        }
+
+        else if (mode == "batch") {
+            std::string queryFolderPath = argv[2];
+            std::string featureType = argv[3];
+            std::string dataset = argv[4];
+
+            if (!checkExist(local_features, featureType) && !checkExist(global_features, featureType)) {
+                std::cerr << "Invalid feature type!" << std::endl;
+                return 0;
+            }
+
+            // Local features are matched through their BoVW histograms, so the codebook is loaded once for all queries
+            std::string data = featureType;
+            Mat centers;
+            if (checkExist(local_features, featureType)) {
+                centers = readCodebookFromFile(database_path + featureType + "_codebook_" + dataset + ".xml");
+                data = featureType + "_histogram";
+            }
+
+            std::vector<std::string> queryPaths;
+            std::vector<Mat> queryFeatures;
+            for (const auto& entry : std::filesystem::directory_iterator(queryFolderPath)) {
+                if (!entry.is_regular_file()) {
+                    continue;
+                }
+
+                std::string queryImagePath = entry.path().string();
+                Mat image;
+                {
+                    TRACE_SCOPE("decode");
+                    image = cv::imread(queryImagePath, cv::IMREAD_COLOR);
+                }
+                if (image.empty()) {
+                    std::cerr << "Failed to read image: " << queryImagePath << std::endl;
+                    continue;
+                }
+
+                Mat query_feature = extractFeaturesFromImage(image, featureType);
+                if (!centers.empty() && !query_feature.empty()) {
+                    query_feature = CalculateQueryHistograms(query_feature, centers);
+                }
+                if (query_feature.empty()) {
+                    std::cerr << "Feature extraction failed for image: " << queryImagePath << std::endl;
+                    continue;
+                }
+
+                queryPaths.push_back(queryImagePath);
+                queryFeatures.push_back(query_feature);
+            }
+            std::cout << "Extracted " << queryFeatures.size() << " queries" << std::endl;
+
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<std::vector<std::string>> topImages;
+            {
+                TRACE_SCOPE("retrieve");
+                topImages = findTopSimilarImagesBatch(queryFeatures, db, data, dataset, n, database_path, batch_size, tile_rows);
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> duration = end - start;
+            std::cout << "Total runtime: " << duration.count() << " seconds" << std::endl;
+
+            TRACE_SCOPE("evaluate");
+            std::map<std::string, std::set<std::string>> ground_truth;
+            if (dataset == "TMBuD") {
+                ground_truth = load_csv(TMBuD_label);
+            }
+            else if (dataset == "CD") {
+                ground_truth = load_csv(CD_label);
+            }
+
+            double total_map = 0.0;
+            for (size_t i = 0; i < queryPaths.size(); ++i) {
+                std::vector<std::string> retrieved_filenames;
+                std::cout << queryPaths[i] << ":";
+                for (const auto& path : topImages[i]) {
+                    retrieved_filenames.push_back(get_image_name(path));
+                    std::cout << " " << retrieved_filenames.back();
+                }
+                std::cout << std::endl;
+                total_map += calculate_map(queryPaths[i], retrieved_filenames, ground_truth);
+            }
+            if (!queryPaths.empty()) {
+                std::cout << "MAP score: " << total_map / queryPaths.size() << std::endl;
+            }
+        }
+
+        else if (mode == "dedup") {
+            std::string action = argv[2];
+            std::string featureType = argv[3];
+            std::string dataset = argv[4];
+
+            if (action != "report" && action != "drop") {
+                std::cerr << "Dedup action must be report or drop" << std::endl;
+                return 0;
+            }
+
+            // Every store of the dataset is collapsed together so they keep the same images
+            std::vector<std::string> relatedTypes(global_features.begin(), global_features.end());
+            for (const auto& feature : local_features) {
+                relatedTypes.push_back(feature);
+                relatedTypes.push_back(feature + "_histogram");
+            }
+
+            dedupAndSaveFeatures(db, featureType, dataset, database_path, dedup_threshold, action == "drop", relatedTypes, tile_rows);
+        }
+
+        else if (mode == "live") {
+            // Replays a command file (insert <image>, delete <image>, query <image>, compact) against a live index;
+            // queries run on their own threads while inserts and deletes keep being published
+            std::string commandsPath = argv[2];
+            std::string featureType = argv[3];
+            std::string dataset = argv[4];
+
+            if (!checkExist(local_features, featureType) && !checkExist(global_features, featureType)) {
+                std::cerr << "Invalid feature type!" << std::endl;
+                return 0;
+            }
+
+            Mat centers;
+            if (checkExist(local_features, featureType)) {
+                centers = readCodebookFromFile(database_path + featureType + "_codebook_" + dataset + ".xml");
+                if (centers.empty()) {
+                    return 0;
+                }
+            }
+
+            std::ifstream commands(commandsPath);
+            if (!commands.is_open()) {
+                std::cerr << "Error opening commands file: " << commandsPath << std::endl;
+                return 0;
+            }
+
+            LiveIndex index(db, featureType, dataset, database_path, centers);
+            index.load();
+            index.startCompaction(std::chrono::milliseconds(live_interval), live_segments);
+
+            std::mutex output;
+            std::vector<std::future<void>> queries;
+            std::string line;
+            while (getline(commands, line)) {
+                size_t space = line.find(' ');
+                std::string command = line.substr(0, space);
+                std::string argument = space == std::string::npos ? "" : line.substr(space + 1);
+
+                if (command == "insert") {
+                    index.insert(argument);
+                }
+                else if (command == "delete") {
+                    index.remove(argument);
+                }
+                else if (command == "compact") {
+                    index.compact();
+                }
+                else if (command == "query") {
+                    queries.push_back(std::async(std::launch::async, [&index, &output, argument, n]() {
+                        Mat image = cv::imread(argument, cv::IMREAD_COLOR);
+                        if (image.empty()) {
+                            std::lock_guard<std::mutex> lock(output);
+                            std::cerr << "Failed to read image: " << argument << std::endl;
+                            return;
+                        }
+
+                        std::vector<std::pair<std::string, double>> results = index.search(index.queryFeature(image), n);
+                        std::lock_guard<std::mutex> lock(output);
+                        std::cout << argument << ":";
+                        for (const auto& result : results) {
+                            std::cout << " " << get_image_name(result.first) << " (" << result.second << ")";
+                        }
+                        std::cout << std::endl;
+                    }));
+                }
+                else if (!command.empty()) {
+                    std::cerr << "Unknown live command: " << command << std::endl;
+                }
+            }
+
+            for (auto& query : queries) {
+                query.wait();
+            }
+            index.stopCompaction();
+            index.compact();
+            std::cout << "Live index holds " << index.snapshot()->liveCount() << " images" << std::endl;
+        }
+
+        else if (mode == "worker") {
+            // <port>:<first image>:<end image>, e.g. 9001:0:5000; the end may be omitted to serve to the last image
+            std::vector<std::string> spec = split(argv[2], ':');
+            std::string featureType = argv[3];
+            std::string dataset = argv[4];
+
+            int port = stoi(spec[0]);
+            int begin = spec.size() > 1 ? stoi(spec[1]) : 0;
+            int end = spec.size() > 2 && !spec[2].empty() ? stoi(spec[2]) : -1;
+
+            // Local features are served from their BoVW histograms
+            std::string data = checkExist(local_features, featureType) ? featureType + "_histogram" : featureType;
+            return runRetrievalWorker(db, port, begin, end, worker_clients, data, dataset, database_path);
+        }
+
+        else if (mode == "distributed") {
+            std::string queryImagePath = argv[2];
+            std::string featureType = argv[3];
+            std::string dataset = argv[4];
+
+            if (!checkExist(local_features, featureType) && !checkExist(global_features, featureType)) {
+                std::cerr << "Invalid feature type!" << std::endl;
+                return 0;
+            }
+            if (workers.empty()) {
+                std::cerr << "No workers configured in [DISTRIBUTED] workers" << std::endl;
+                return 0;
+            }
+
+            Mat image = cv::imread(queryImagePath, cv::IMREAD_COLOR);
+            if (image.empty()) {
+                std::cerr << "Failed to read image" << std::endl;
+                return 0;
+            }
+
+            // The query is extracted once here and only the feature vector is sent to the workers
+            Mat query_feature = extractFeaturesFromImage(image, featureType);
+            if (checkExist(local_features, featureType)) {
+                Mat centers = readCodebookFromFile(database_path + featureType + "_codebook_" + dataset + ".xml");
+                query_feature = CalculateQueryHistograms(query_feature, centers);
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            ScatterGatherResult answer = scatterGatherSearch(query_feature, workers, n, worker_timeout);
+            auto end = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> duration = end - start;
+            std::cout << "Total runtime: " << duration.count() << " seconds" << std::endl;
+
+            if (answer.workersAnswered < answer.workersTotal) {
+                std::cout << "Degraded result: " << answer.workersAnswered << " of " << answer.workersTotal << " workers answered" << std::endl;
+            }
+
             std::vector<std::string> retrieved_filenames;
-            for (const auto& path : topImages) {
-                retrieved_filenames.push_back(get_image_name(path));
+            for (const auto& result : answer.results) {
+                retrieved_filenames.push_back(get_image_name(result.first));
+                std::cout << result.first << " (" << result.second << ")" << std::endl;
             }
 
             std::map<std::string, std::set<std::string>> ground_truth;
             if (dataset == "TMBuD") {
-                ground_truth = load_csv(TMBuD_label); 
+                ground_truth = load_csv(TMBuD_label);
             }
             else if (dataset == "CD") {
                 ground_truth = load_csv(CD_label);
             }
-            double map_score = calculate_map(queryImagePath, retrieved_filenames, ground_truth);
-            std::cout << "MAP score: " << map_score << std::endl;
-            
-            displayImagesInSeparateWindows(queryImagePath, topImages);
-            queryImagePath = "";
+            std::cout << "MAP score: " << calculate_map(queryImagePath, retrieved_filenames, ground_truth) << std::endl;
+        }
+
+        else if (mode == "sweep") {
+            std::string queryFolderPath = argv[2];
+            std::string featureType = argv[3];
+            std::string dataset = argv[4];
+
+            // "all" runs the [SWEEP] feature list, anything else narrows the grid to one feature type
+            std::vector<std::string> featureTypes = sweep_features;
+            if (featureType != "all") {
+                featureTypes = { featureType };
+            }
+            for (const auto& type : featureTypes) {
+                if (type != "sift_histogram" && !checkExist(local_features, type) && !checkExist(global_features, type) && type != "phash") {
+                    std::cerr << "Invalid feature type: " << type << std::endl;
+                    return 0;
+                }
+            }
+
+            std::map<std::string, std::set<std::string>> ground_truth;
+            if (dataset == "TMBuD") {
+                ground_truth = load_csv(TMBuD_label);
+            }
+            else if (dataset == "CD") {
+                ground_truth = load_csv(CD_label);
+            }
+
+            std::vector<SweepResult> results = runParameterSweep(db, queryFolderPath, featureTypes, sweep_ks, sweep_weights, sweep_index, local_features, dataset, database_path, n, ground_truth);
+            printSweepTable(results, std::cout);
+            saveSweepTable(results, sweep_output);
+        }
+
+        else if (mode == "engine") {
+            std::string queryFolderPath = argv[2];
+            std::string featureType = argv[3];
+            std::string dataset = argv[4];
+
+            EngineOptions options = readEngineOptions(config, dataset);
+            options.featureTypes = { featureType };
+            RetrievalEngine engine(options);
+            engine.load();
+            if (!engine.hasFeature(featureType)) {
+                std::cerr << "Invalid feature type!" << std::endl;
+                return 0;
+            }
+
+            // Queries are handed over as encoded bytes, the way an embedding service would receive them
+            std::vector<std::string> queryPaths;
+            std::vector<std::vector<uchar>> queryBytes;
+            for (const auto& entry : std::filesystem::directory_iterator(queryFolderPath)) {
+                if (!entry.is_regular_file()) {
+                    continue;
+                }
+                std::ifstream file(entry.path(), std::ios::binary);
+                queryPaths.push_back(entry.path().string());
+                queryBytes.emplace_back((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            }
+
+            // One engine shared by every thread, each pulling the next query
+            int threads = engine_threads > 0 ? engine_threads : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+            std::vector<std::vector<EngineResult>> results(queryPaths.size());
+            std::atomic<size_t> next(0);
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; ++t) {
+                workers.emplace_back([&]() {
+                    for (size_t i = next++; i < queryBytes.size(); i = next++) {
+                        results[i] = engine.search(queryBytes[i], featureType, n);
+                    }
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> duration = end - start;
+            std::cout << queryPaths.size() << " queries on " << threads << " threads in " << duration.count() << " seconds" << std::endl;
+
+            std::map<std::string, std::set<std::string>> ground_truth;
+            if (dataset == "TMBuD") {
+                ground_truth = load_csv(TMBuD_label);
+            }
+            else if (dataset == "CD") {
+                ground_truth = load_csv(CD_label);
+            }
+
+            double total_map = 0.0;
+            for (size_t i = 0; i < queryPaths.size(); ++i) {
+                std::vector<std::string> retrieved_filenames;
+                std::cout << queryPaths[i] << ":";
+                for (const auto& result : results[i]) {
+                    retrieved_filenames.push_back(get_image_name(result.id));
+                    std::cout << " " << retrieved_filenames.back() << " (" << result.score << ")";
+                }
+                std::cout << std::endl;
+                total_map += calculate_map(queryPaths[i], retrieved_filenames, ground_truth);
+            }
+            if (!queryPaths.empty()) {
+                std::cout << "MAP score: " << total_map / queryPaths.size() << std::endl;
+            }
+        }
+
+        else if (mode == "pack") {
+            std::string target = argv[2];
+            std::string featureType = argv[3];
+            std::string dataset = argv[4];
+
+            if (!checkExist(local_features, featureType) && !checkExist(global_features, featureType)) {
+                std::cerr << "Invalid feature type!" << std::endl;
+                return 0;
+            }
+
+            // Retrieval scans the BoVW histograms of local features, so those are what gets packed
+            std::string store = checkExist(local_features, featureType) ? featureType + "_histogram" : featureType;
+            if (target == "chunks") {
+                // The deadline-bounded search reuses this index instead of building it on the first query
+                FeatureMatrix features = packFeatures(db.loadFeatures(store, dataset, database_path));
+                ChunkIndex index = buildChunkIndex(features, chunk_rows);
+                if (!features.data.empty() && saveChunkIndex(index, features.data.cols, db.chunkIndexFilename(store, dataset, database_path), sourceStamp(db.featureFilename(store, dataset, database_path)))) {
+                    std::cout << "Chunk index written to " << db.chunkIndexFilename(store, dataset, database_path) << std::endl;
+                }
+            }
+            else if (db.saveRowStore(store, dataset, database_path)) {
+                std::cout << "Row store written to " << db.rowStoreFilename(store, dataset, database_path) << std::endl;
+            }
+        }
+
+        else if (mode == "memory") {
+            std::string featureType = argv[3];
+            std::string dataset = argv[4];
+
+            // Loads what a retrieval node holds for each feature type so the ledger can report it
+            std::vector<std::string> featureTypes;
+            if (featureType == "all") {
+                featureTypes.insert(featureTypes.end(), local_features.begin(), local_features.end());
+                featureTypes.insert(featureTypes.end(), global_features.begin(), global_features.end());
+            }
+            else if (checkExist(local_features, featureType) || checkExist(global_features, featureType)) {
+                featureTypes.push_back(featureType);
+            }
+            else {
+                std::cerr << "Invalid feature type!" << std::endl;
+                return 0;
+            }
+
+            // Everything a serving node would hold stays loaded until the report is printed; each store is counted once
+            std::vector<FeatureMatrix> stores;
+            std::vector<Mat> codebooks;
+            std::vector<MemoryHandle> resident;
+            for (const auto& type : featureTypes) {
+                std::string data = type;
+                if (checkExist(local_features, type)) {
+                    std::string file_name = database_path + type + "_codebook_" + dataset + ".xml";
+                    codebooks.push_back(readCodebookFromFile(file_name));
+                    resident.emplace_back("codebook/" + type, matBytes(codebooks.back()), codebooks.back().rows);
+                    data = type + "_histogram";
+                }
+                stores.push_back(packFeatures(db.loadFeatures(data, dataset, database_path)));
+                resident.push_back(trackFeatureMatrix("features/" + data, stores.back()));
+            }
+            std::unordered_map<std::string, std::vector<uchar>> thumbnails = db.loadThumbnails(dataset, database_path, thumbnail_size);
+            resident.emplace_back("thumbnails/" + dataset, thumbnailBytes(thumbnails), thumbnails.size());
+
+            MemoryLedger::instance().printReport(std::cout);
         }
 
         else {
@@ -166,6 +803,10 @@ int main(int argc, char* argv[]) {
             return 0;
         }
 
+        if (memory_report) {
+            MemoryLedger::instance().printReport(std::cout);
+        }
+
 
         return 0;
     }
@@ -0,0 +1,390 @@
+#include "Processing.hpp"
+#include "Codebook.hpp"
+#include "Retrieval.hpp"
+#include "HashIndex.hpp"
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+// One benchmarked stage: wall time of every repetition plus how many items each repetition processed
+struct Measurement {
+    std::string name;
+    std::vector<double> seconds;
+    double items = 1;
+};
+
+template <typename Function>
+Measurement measure(const std::string& name, int repeat, double items, Function function) {
+    Measurement measurement;
+    measurement.name = name;
+    measurement.items = items;
+
+    for (int i = 0; i < repeat; ++i) {
+        auto start = std::chrono::high_resolution_clock::now();
+        function();
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> duration = end - start;
+        measurement.seconds.push_back(duration.count());
+    }
+
+    std::cout << name << ": " << measurement.seconds.front() << " seconds (first run)" << std::endl;
+    return measurement;
+}
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    size_t middle = values.size() / 2;
+    return values.size() % 2 ? values[middle] : 0.5 * (values[middle - 1] + values[middle]);
+}
+
+std::vector<int> parseList(const std::string& list) {
+    std::vector<int> values;
+    std::stringstream ss(list);
+    std::string value;
+    while (getline(ss, value, ',')) {
+        values.push_back(stoi(value));
+    }
+    return values;
+}
+
+// Deterministic synthetic photo: filled rectangles and circles on a noisy background, so every extractor has structure to find
+Mat makeSyntheticImage(RNG& rng, int width, int height) {
+    Mat image(height, width, CV_8UC3);
+    rng.fill(image, RNG::UNIFORM, 0, 64);
+
+    int shapes = rng.uniform(8, 24);
+    for (int i = 0; i < shapes; ++i) {
+        Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+        Point center(rng.uniform(0, width), rng.uniform(0, height));
+        int size = rng.uniform(5, std::max(6, std::min(width, height) / 3));
+
+        if (rng.uniform(0, 2) == 0) {
+            cv::rectangle(image, Rect(center.x, center.y, size, size), color, cv::FILLED);
+        }
+        else {
+            cv::circle(image, center, size / 2, color, cv::FILLED);
+        }
+    }
+    return image;
+}
+
+// Synthetic global feature store: L1-normalized non-negative rows, like the color histograms
+std::vector<std::pair<std::string, Mat>> makeSyntheticFeatures(RNG& rng, int count, int dims) {
+    std::vector<std::pair<std::string, Mat>> features;
+    features.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        Mat feature(1, dims, CV_32F);
+        rng.fill(feature, RNG::UNIFORM, 0.0f, 1.0f);
+        feature /= cv::sum(feature)[0];
+        features.emplace_back("synthetic/" + std::to_string(i) + ".jpg", feature);
+    }
+    return features;
+}
+
+void writeResults(const std::string& filename, const std::vector<Measurement>& measurements, std::unordered_map<std::string, std::string>& settings) {
+    cv::FileStorage fs(filename, cv::FileStorage::WRITE | cv::FileStorage::FORMAT_JSON);
+    if (!fs.isOpened()) {
+        std::cerr << "Failed to open file for writing: " << filename << std::endl;
+        return;
+    }
+
+    fs << "settings" << "{";
+    for (const auto& setting : settings) {
+        fs << setting.first << setting.second;
+    }
+    fs << "}";
+
+    fs << "results" << "{";
+    for (const auto& measurement : measurements) {
+        double total = 0.0;
+        for (double seconds : measurement.seconds) {
+            total += seconds;
+        }
+        double medianSeconds = median(measurement.seconds);
+
+        fs << measurement.name << "{";
+        fs << "median_ms" << medianSeconds * 1000.0;
+        fs << "min_ms" << *std::min_element(measurement.seconds.begin(), measurement.seconds.end()) * 1000.0;
+        fs << "mean_ms" << total / measurement.seconds.size() * 1000.0;
+        fs << "items" << measurement.items;
+        fs << "items_per_second" << (medianSeconds > 0 ? measurement.items / medianSeconds : 0.0);
+        fs << "repeat" << static_cast<int>(measurement.seconds.size());
+        fs << "}";
+    }
+    fs << "}";
+
+    fs.release();
+    std::cout << "Benchmark results saved to " << filename << std::endl;
+}
+
+// Print the median of every stage next to the one stored in a previous results file
+void compareWithBaseline(const std::string& filename, const std::vector<Measurement>& measurements) {
+    cv::FileStorage fs(filename, cv::FileStorage::READ | cv::FileStorage::FORMAT_JSON);
+    if (!fs.isOpened()) {
+        std::cerr << "Failed to open baseline: " << filename << std::endl;
+        return;
+    }
+
+    cv::FileNode results = fs["results"];
+    std::cout << "\nStage, median ms, baseline ms, speedup" << std::endl;
+    for (const auto& measurement : measurements) {
+        double current = median(measurement.seconds) * 1000.0;
+        cv::FileNode node = results[measurement.name];
+        if (node.empty()) {
+            std::cout << measurement.name << ", " << current << ", -, -" << std::endl;
+            continue;
+        }
+
+        double baseline = 0.0;
+        node["median_ms"] >> baseline;
+        std::cout << measurement.name << ", " << current << ", " << baseline << ", " << (current > 0 ? baseline / current : 0.0) << std::endl;
+    }
+    fs.release();
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "<output.json> [baseline.json]" << std::endl;
+        return 0;
+    }
+
+    std::string config_file = "config.ini";
+    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> config;
+    readConfig(config_file, config);
+
+    int numImages = stoi(getConfigValue(config, "BENCHMARK", "images", "50"));
+    int width = stoi(getConfigValue(config, "BENCHMARK", "width", "320"));
+    int height = stoi(getConfigValue(config, "BENCHMARK", "height", "240"));
+    int k = stoi(getConfigValue(config, "BENCHMARK", "k", "50"));
+    int repeat = std::max(1, stoi(getConfigValue(config, "BENCHMARK", "repeat", "5")));
+    int seed = stoi(getConfigValue(config, "BENCHMARK", "seed", "42"));
+    int batch = std::max(1, stoi(getConfigValue(config, "BENCHMARK", "batch", "16")));
+    std::vector<int> sizes = parseList(getConfigValue(config, "BENCHMARK", "sizes", "1000,10000"));
+    std::vector<int> results = parseList(getConfigValue(config, "BENCHMARK", "results", "1,10,100"));
+    std::string workPath = getConfigValue(config, "BENCHMARK", "path", "bench/");
+
+    std::filesystem::create_directories(workPath);
+
+    std::unordered_map<std::string, std::string> settings = {
+        { "images", std::to_string(numImages) }, { "width", std::to_string(width) }, { "height", std::to_string(height) },
+        { "k", std::to_string(k) }, { "batch", std::to_string(batch) }, { "repeat", std::to_string(repeat) }, { "seed", std::to_string(seed) },
+        { "sizes", getConfigValue(config, "BENCHMARK", "sizes", "1000,10000") }, { "results", getConfigValue(config, "BENCHMARK", "results", "1,10,100") }
+    };
+
+    std::vector<Measurement> measurements;
+    FeatureDatabase db;
+
+    // Synthetic image corpus
+    RNG rng(seed);
+    std::vector<Mat> images;
+    for (int i = 0; i < numImages; ++i) {
+        images.push_back(makeSyntheticImage(rng, width, height));
+    }
+
+    // Per-extractor throughput
+    std::vector<std::string> featureTypes = { "histogram", "correlogram", "sift", "orb" };
+    std::vector<std::pair<std::string, Mat>> siftFeatures;
+    for (const auto& featureType : featureTypes) {
+        measurements.push_back(measure("extract_" + featureType, repeat, numImages, [&]() {
+            for (const auto& image : images) {
+                extractFeaturesFromImage(image, featureType);
+            }
+        }));
+    }
+
+    for (int i = 0; i < numImages; ++i) {
+        Mat descriptors = extractFeaturesFromImage(images[i], "sift");
+        if (!descriptors.empty()) {
+            siftFeatures.emplace_back("synthetic/" + std::to_string(i) + ".jpg", descriptors);
+        }
+    }
+
+    // Codebook training and BoVW encoding on the SIFT descriptors of the corpus
+    Mat centers;
+    measurements.push_back(measure("codebook_k" + std::to_string(k), repeat, numImages, [&]() {
+        cv::theRNG().state = seed;
+        centers = ClusteringFeature(siftFeatures, k);
+    }));
+
+    measurements.push_back(measure("encode_k" + std::to_string(k), repeat, numImages, [&]() {
+        CalculateHistograms(siftFeatures, centers);
+    }));
+
+    // Scoring kernels at the fixed feature sizes: checked per-call path, generic double loop, specialized float-lane kernel
+    std::vector<int> kernelDims = { 768, 2560, k };
+    int kernelRows = 10000;
+    for (int dims : kernelDims) {
+        RNG kernelRng(seed + dims);
+        std::vector<std::pair<std::string, Mat>> kernelFeatures = makeSyntheticFeatures(kernelRng, kernelRows, dims);
+        Mat query = kernelFeatures.front().second;
+        CosineKernel generic = selectCosineKernel(-1, CV_32F);
+        CosineKernel fixed = selectCosineKernel(dims, CV_32F);
+        std::string suffix = "_D" + std::to_string(dims);
+        volatile double sink = 0.0;
+
+        measurements.push_back(measure("kernel_checked" + suffix, repeat, kernelRows, [&]() {
+            for (const auto& feature : kernelFeatures) {
+                sink = sink + computeCosineSimilarity(query, feature.second);
+            }
+        }));
+        measurements.push_back(measure("kernel_generic" + suffix, repeat, kernelRows, [&]() {
+            for (const auto& feature : kernelFeatures) {
+                sink = sink + generic(query.ptr(), feature.second.ptr(), dims);
+            }
+        }));
+        if (isSpecializedKernel(dims, CV_32F)) {
+            measurements.push_back(measure("kernel_fixed" + suffix, repeat, kernelRows, [&]() {
+                for (const auto& feature : kernelFeatures) {
+                    sink = sink + fixed(query.ptr(), feature.second.ptr(), dims);
+                }
+            }));
+
+            // The specialized kernel sums float lanes per block, so its scores may drift from the double loop slightly
+            double maxDifference = 0.0;
+            for (const auto& feature : kernelFeatures) {
+                double difference = fixed(query.ptr(), feature.second.ptr(), dims) - generic(query.ptr(), feature.second.ptr(), dims);
+                maxDifference = std::max(maxDifference, std::abs(difference));
+            }
+            std::cout << "kernel_fixed" << suffix << ": max score difference to the generic loop " << maxDifference << std::endl;
+        }
+    }
+
+    // Multi-index hash lookups checked against a brute-force Hamming scan on random hashes, before and after a
+    // save/load round trip; any disagreement is reported, and the timings show what the index saves
+    for (int size : sizes) {
+        RNG hashRng(seed + 7 * size);
+        MultiIndexHash index;
+        std::vector<uint64_t> hashes(size);
+        for (int i = 0; i < size; ++i) {
+            hashes[i] = (static_cast<uint64_t>(hashRng.next()) << 32) | hashRng.next();
+            index.add("hash/" + std::to_string(i), hashes[i]);
+        }
+        index.index();
+
+        std::string indexFile = workPath + "hash" + std::to_string(size) + ".mih";
+        SourceStamp stamp;
+        stamp.size = static_cast<uint64_t>(size);
+        MultiIndexHash reloaded;
+        if (!index.save(indexFile, stamp) || !reloaded.load(indexFile, stamp)) {
+            std::cerr << "Hash index round trip failed for N=" << size << std::endl;
+        }
+
+        // Queries are stored hashes with a few bits flipped, so every radius has hits to agree on
+        std::vector<uint64_t> queries(batch);
+        for (auto& query : queries) {
+            query = hashes[hashRng.uniform(0, size)];
+            for (int flips = hashRng.uniform(0, 9); flips > 0; --flips) {
+                query ^= 1ULL << hashRng.uniform(0, 64);
+            }
+        }
+
+        auto bruteForce = [&](uint64_t query, int radius) {
+            std::vector<std::pair<int, int>> hits;
+            for (int i = 0; i < size; ++i) {
+                int distance = hammingDistance(query, hashes[i]);
+                if (distance <= radius) {
+                    hits.push_back({ distance, i });
+                }
+            }
+            std::sort(hits.begin(), hits.end());
+
+            std::vector<std::pair<std::string, int>> results;
+            for (const auto& hit : hits) {
+                results.push_back({ "hash/" + std::to_string(hit.second), hit.first });
+            }
+            return results;
+        };
+
+        int mismatches = 0;
+        for (int radius : { 0, 4, 8, 12 }) {
+            for (uint64_t query : queries) {
+                std::vector<std::pair<std::string, int>> expected = bruteForce(query, radius);
+                mismatches += index.search(query, radius) != expected;
+                mismatches += reloaded.search(query, radius) != expected;
+            }
+        }
+        std::cout << "hash_index_N" << size << ": " << mismatches << " mismatches against brute force" << std::endl;
+        if (mismatches > 0) {
+            std::cerr << "Multi-index hash results differ from the brute-force scan for N=" << size << std::endl;
+        }
+
+        measurements.push_back(measure("hash_index_N" + std::to_string(size), repeat, static_cast<double>(size) * batch, [&]() {
+            for (uint64_t query : queries) {
+                index.search(query, 4);
+            }
+        }));
+        measurements.push_back(measure("hash_scan_N" + std::to_string(size), repeat, static_cast<double>(size) * batch, [&]() {
+            for (uint64_t query : queries) {
+                bruteForce(query, 4);
+            }
+        }));
+    }
+
+    // Database load and scan latency for stores of increasing size
+    for (int size : sizes) {
+        RNG featureRng(seed + size);
+        std::string featureType = "synthetic" + std::to_string(size);
+        db.saveFeatures(makeSyntheticFeatures(featureRng, size, 768), featureType, "bench", workPath);
+
+        std::vector<std::pair<std::string, Mat>> databaseFeatures;
+        measurements.push_back(measure("load_N" + std::to_string(size), repeat, size, [&]() {
+            databaseFeatures = db.loadFeatures(featureType, "bench", workPath);
+        }));
+
+        Mat query = makeSyntheticFeatures(featureRng, 1, 768).front().second;
+        for (int n : results) {
+            measurements.push_back(measure("scan_N" + std::to_string(size) + "_n" + std::to_string(n), repeat, size, [&]() {
+                rankBySimilarity(query, databaseFeatures, n);
+            }));
+        }
+
+        // The same query batch scored one query at a time and as one blocked pass
+        std::vector<std::pair<std::string, Mat>> batchQueries = makeSyntheticFeatures(featureRng, batch, 768);
+        FeatureMatrix store = packFeatures(databaseFeatures);
+        Mat queries = packFeatures(batchQueries).data;
+        std::string suffix = "_N" + std::to_string(size) + "_q" + std::to_string(batch);
+
+        measurements.push_back(measure("sequential" + suffix, repeat, static_cast<double>(size) * batch, [&]() {
+            for (const auto& batchQuery : batchQueries) {
+                rankBySimilarity(batchQuery.second, databaseFeatures, results.back());
+            }
+        }));
+        measurements.push_back(measure("batched" + suffix, repeat, static_cast<double>(size) * batch, [&]() {
+            rankBatchBySimilarity(queries, store, results.back());
+        }));
+
+        // Same store with about 90% of the bins zeroed, scanned densely and through the sparse format
+        std::vector<std::pair<std::string, Mat>> sparseFeatures;
+        for (const auto& feature : databaseFeatures) {
+            Mat sparse = feature.second.clone();
+            float* values = sparse.ptr<float>(0);
+            for (int i = 0; i < sparse.cols; ++i) {
+                if (featureRng.uniform(0, 10) != 0) {
+                    values[i] = 0.0f;
+                }
+            }
+            sparseFeatures.emplace_back(feature.first, sparse);
+        }
+
+        FeatureDatabase sparseDb;
+        sparseDb.setSparseDensity(0.25);
+        sparseDb.saveFeatures(sparseFeatures, "sparse" + std::to_string(size), "bench", workPath);
+        SparseFeatureStore sparseStore = sparseDb.loadSparseFeatures("sparse" + std::to_string(size), "bench", workPath);
+
+        measurements.push_back(measure("dense_scan_sparse_data_N" + std::to_string(size), repeat, size, [&]() {
+            rankBySimilarity(query, sparseFeatures, results.back());
+        }));
+        measurements.push_back(measure("sparse_scan_N" + std::to_string(size), repeat, size, [&]() {
+            rankSparseBySimilarity(query, sparseStore, results.back(), 0.25);
+        }));
+    }
+
+    writeResults(argv[1], measurements, settings);
+    if (argc == 3) {
+        compareWithBaseline(argv[2], measurements);
+    }
+
+    return 0;
+}
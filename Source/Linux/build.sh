@@ -0,0 +1,29 @@
+#!/bin/sh
+# Linux build of the CLI (21127730) and the benchmark against the system OpenCV 4, found through pkg-config.
+# Usage: Source/Linux/build.sh [output directory, default Source/Linux/build]
+set -e
+
+SOURCE=$(cd "$(dirname "$0")/.." && pwd)
+OUTPUT=${1:-$SOURCE/Linux/build}
+CXX=${CXX:-c++}
+CXXFLAGS=${CXXFLAGS:--O2}
+
+mkdir -p "$OUTPUT/objects"
+OPENCV_CFLAGS=$(pkg-config --cflags opencv4)
+OPENCV_LIBS=$(pkg-config --libs opencv4)
+
+# Every translation unit of the CLI except main.cpp is shared with the benchmark
+OBJECTS=""
+for file in "$SOURCE"/21127730/*.cpp; do
+    name=$(basename "$file" .cpp)
+    echo "Compiling $name.cpp"
+    $CXX -std=c++17 $CXXFLAGS -pthread $OPENCV_CFLAGS -c "$file" -o "$OUTPUT/objects/$name.o"
+    if [ "$name" != "main" ]; then
+        OBJECTS="$OBJECTS $OUTPUT/objects/$name.o"
+    fi
+done
+$CXX -std=c++17 $CXXFLAGS -pthread $OPENCV_CFLAGS -I"$SOURCE/21127730" -c "$SOURCE/Benchmark/Benchmark.cpp" -o "$OUTPUT/objects/Benchmark.o"
+
+$CXX -pthread $OBJECTS "$OUTPUT/objects/main.o" -o "$OUTPUT/21127730" $OPENCV_LIBS
+$CXX -pthread $OBJECTS "$OUTPUT/objects/Benchmark.o" -o "$OUTPUT/Benchmark" $OPENCV_LIBS
+echo "Built $OUTPUT/21127730 and $OUTPUT/Benchmark"
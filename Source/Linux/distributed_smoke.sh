@@ -0,0 +1,152 @@
+#!/bin/sh
+# Multi-process smoke test of the distributed mode on one machine: N workers on loopback ports and a coordinator.
+# The query runs with every worker up, with one worker stopped (it must time out, not hang the coordinator) and
+# with one worker killed (it must be reported unavailable); the remaining workers must then shut down on SIGTERM.
+# Usage: Source/Linux/distributed_smoke.sh [workers, default 3]
+#   BIN  CLI to test, default Source/Linux/build/21127730 (built with build.sh when missing)
+#   PORT first worker port, default 19101
+set -e
+
+SOURCE=$(cd "$(dirname "$0")/.." && pwd)
+WORKERS=${1:-3}
+BIN=${BIN:-$SOURCE/Linux/build/21127730}
+PORT=${PORT:-19101}
+IMAGES=24
+TIMEOUT_MS=2000
+
+if [ "$WORKERS" -lt 2 ]; then
+    echo "Need at least 2 workers to test the degraded path"
+    exit 1
+fi
+if [ ! -x "$BIN" ]; then
+    "$SOURCE/Linux/build.sh"
+fi
+
+WORK=$(mktemp -d)
+PIDS=""
+cleanup() {
+    for pid in $PIDS; do
+        kill -CONT "$pid" 2>/dev/null || true
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $1"
+    for log in "$WORK"/*.log; do
+        echo "--- $log"
+        cat "$log"
+    done
+    exit 1
+}
+
+# Deterministic 64x48 binary PPM images, which imread decodes without any codec; each has its own dominant colour
+mkdir -p "$WORK/images" "$WORK/database"
+i=0
+while [ $i -lt $IMAGES ]; do
+    LC_ALL=C awk -v seed=$i 'BEGIN {
+        srand(seed + 1)
+        printf "P6\n64 48\n255\n"
+        for (p = 0; p < 64 * 48; p++) {
+            printf "%c%c%c", 1 + (seed * 37 + int(rand() * 48)) % 255, 1 + (seed * 91 + int(rand() * 48)) % 255, 1 + (seed * 53 + int(rand() * 48)) % 255
+        }
+    }' > "$WORK/images/image$i.ppm"
+    i=$((i + 1))
+done
+
+ADDRESSES=""
+i=0
+while [ $i -lt "$WORKERS" ]; do
+    ADDRESSES="$ADDRESSES${ADDRESSES:+,}127.0.0.1:$((PORT + i))"
+    i=$((i + 1))
+done
+
+# main.cpp reads config.ini from the working directory
+cat > "$WORK/config.ini" <<CONFIG
+[FEATURES]
+local = sift,orb
+global = histogram
+hash = phash
+
+[RETRIEVE]
+n = 5
+
+[PATH]
+path = $WORK/database/
+
+[DISTRIBUTED]
+workers = $ADDRESSES
+timeout_ms = $TIMEOUT_MS
+worker_clients = 4
+CONFIG
+cd "$WORK"
+
+"$BIN" extract "$WORK/images" histogram SMOKE > extract.log 2>&1 || fail "extract exited with an error"
+# Packed once up front, so the workers only read the row store instead of racing to build it
+"$BIN" pack rows histogram SMOKE > pack.log 2>&1 || fail "pack exited with an error"
+
+# Contiguous ranges that together cover every image
+i=0
+while [ $i -lt "$WORKERS" ]; do
+    begin=$((i * IMAGES / WORKERS))
+    end=$(((i + 1) * IMAGES / WORKERS))
+    "$BIN" worker "$((PORT + i)):$begin:$end" histogram SMOKE > "worker$i.log" 2>&1 &
+    PIDS="$PIDS $!"
+    i=$((i + 1))
+done
+
+i=0
+while [ $i -lt "$WORKERS" ]; do
+    tries=0
+    until grep -q "Worker listening" "worker$i.log" 2>/dev/null; do
+        tries=$((tries + 1))
+        [ $tries -le 100 ] || fail "worker $i never started listening"
+        sleep 0.1
+    done
+    i=$((i + 1))
+done
+
+query() {
+    start=$(date +%s%N)
+    "$BIN" distributed "$WORK/images/image0.ppm" histogram SMOKE > "$1.log" 2>&1 || fail "$1: coordinator exited with an error"
+    ELAPSED_MS=$((($(date +%s%N) - start) / 1000000))
+}
+
+# 1. Every worker up: a complete answer whose best match is the query itself
+query complete
+grep -q "Degraded result" complete.log && fail "complete: a worker did not answer"
+grep -m 1 "ppm (" complete.log | grep -q "image0.ppm" || fail "complete: the query image is not the best match"
+echo "complete: $WORKERS of $WORKERS workers answered in $ELAPSED_MS ms"
+
+FIRST=$(echo $PIDS | cut -d' ' -f1)
+SECOND=$(echo $PIDS | cut -d' ' -f2)
+
+# 2. A hung worker: the coordinator must give up on it at the timeout and answer with the others
+kill -STOP "$SECOND"
+query hung
+kill -CONT "$SECOND"
+grep -q "Degraded result: $((WORKERS - 1)) of $WORKERS" hung.log || fail "hung: expected a degraded result"
+[ "$ELAPSED_MS" -lt $((TIMEOUT_MS + 3000)) ] || fail "hung: coordinator took $ELAPSED_MS ms"
+echo "hung: degraded result in $ELAPSED_MS ms"
+
+# 3. A dead worker: reported unavailable while the others still answer
+kill -KILL "$FIRST"
+wait "$FIRST" 2>/dev/null || true
+query dead
+grep -q "Worker unavailable: 127.0.0.1:$PORT" dead.log || fail "dead: the killed worker was not reported"
+grep -q "Degraded result: $((WORKERS - 1)) of $WORKERS" dead.log || fail "dead: expected a degraded result"
+[ "$ELAPSED_MS" -lt $((TIMEOUT_MS + 3000)) ] || fail "dead: coordinator took $ELAPSED_MS ms"
+echo "dead: degraded result in $ELAPSED_MS ms"
+
+# 4. The remaining workers finish their requests and exit cleanly on SIGTERM
+for pid in $PIDS; do
+    [ "$pid" = "$FIRST" ] && continue
+    kill -TERM "$pid"
+    wait "$pid" || fail "worker $pid exited with an error after SIGTERM"
+done
+PIDS=""
+
+echo "PASS"